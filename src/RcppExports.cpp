@@ -22,26 +22,235 @@ BEGIN_RCPP
 END_RCPP
 }
 // rcpp_time_to_seconds
-Rcpp::IntegerVector rcpp_time_to_seconds(std::vector <std::string> times);
+Rcpp::IntegerVector rcpp_time_to_seconds(Rcpp::CharacterVector times);
 RcppExport SEXP _gtfsrouter_rcpp_time_to_seconds(SEXP timesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::vector <std::string> >::type times(timesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type times(timesSEXP);
     rcpp_result_gen = Rcpp::wrap(rcpp_time_to_seconds(times));
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_csa_engine
+SEXP rcpp_csa_engine(Rcpp::DataFrame timetable, Rcpp::DataFrame transfers, const size_t nstations, const size_t ntrips);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine(SEXP timetableSEXP, SEXP transfersSEXP, SEXP nstationsSEXP, SEXP ntripsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type timetable(timetableSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type transfers(transfersSEXP);
+    Rcpp::traits::input_parameter< const size_t >::type nstations(nstationsSEXP);
+    Rcpp::traits::input_parameter< const size_t >::type ntrips(ntripsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine(timetable, transfers, nstations, ntrips));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_size
+int rcpp_csa_engine_size(SEXP engine);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_size(SEXP engineSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_size(engine));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_last_departure
+int rcpp_csa_engine_last_departure(SEXP engine);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_last_departure(SEXP engineSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_last_departure(engine));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_matches
+bool rcpp_csa_engine_matches(SEXP engine, Rcpp::DataFrame timetable, Rcpp::DataFrame transfers);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_matches(SEXP engineSEXP, SEXP timetableSEXP, SEXP transfersSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type timetable(timetableSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type transfers(transfersSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_matches(engine, timetable, transfers));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_services
+void rcpp_csa_engine_services(SEXP engine, const std::vector <int> trip_service, Rcpp::LogicalMatrix service_days);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_services(SEXP engineSEXP, SEXP trip_serviceSEXP, SEXP service_daysSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <int> >::type trip_service(trip_serviceSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalMatrix >::type service_days(service_daysSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_services(engine, trip_service, service_days));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_copy
+SEXP rcpp_csa_engine_copy(SEXP engine);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_copy(SEXP engineSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_copy(engine));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_update
+int rcpp_csa_engine_update(SEXP engine, const std::vector <int> trips, const std::vector <int> delays, Rcpp::LogicalVector cancelled);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_update(SEXP engineSEXP, SEXP tripsSEXP, SEXP delaysSEXP, SEXP cancelledSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <int> >::type trips(tripsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <int> >::type delays(delaysSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type cancelled(cancelledSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_update(engine, trips, delays, cancelled));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_query
+Rcpp::DataFrame rcpp_csa_engine_query(SEXP engine, const std::vector <size_t> start_stations, const std::vector <size_t> end_stations, const int start_time, const int max_transfers, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_query(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP end_stationsSEXP, SEXP start_timeSEXP, SEXP max_transfersSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type end_stations(end_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time(start_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_transfers(max_transfersSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_query(engine, start_stations, end_stations, start_time, max_transfers, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_reverse
+Rcpp::DataFrame rcpp_csa_engine_reverse(SEXP engine, const std::vector <size_t> start_stations, const std::vector <size_t> end_stations, const int start_time, const int arrival_time, const int max_transfers, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_reverse(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP end_stationsSEXP, SEXP start_timeSEXP, SEXP arrival_timeSEXP, SEXP max_transfersSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type end_stations(end_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time(start_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type arrival_time(arrival_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_transfers(max_transfersSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_reverse(engine, start_stations, end_stations, start_time, arrival_time, max_transfers, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_engine_batch
+Rcpp::DataFrame rcpp_csa_engine_batch(SEXP engine, Rcpp::List start_stations, Rcpp::List end_stations, const std::vector <int> start_times, const int max_transfers, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_csa_engine_batch(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP end_stationsSEXP, SEXP start_timesSEXP, SEXP max_transfersSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type end_stations(end_stationsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <int> >::type start_times(start_timesSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_transfers(max_transfersSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_engine_batch(engine, start_stations, end_stations, start_times, max_transfers, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_profile
+Rcpp::DataFrame rcpp_csa_profile(SEXP engine, const std::vector <size_t> start_stations, const std::vector <size_t> end_stations, const int start_time, const int end_time, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_csa_profile(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP end_stationsSEXP, SEXP start_timeSEXP, SEXP end_timeSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type end_stations(end_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time(start_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type end_time(end_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_profile(engine, start_stations, end_stations, start_time, end_time, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_network_write
+void rcpp_network_write(SEXP engine, const std::string filename, Rcpp::DataFrame stops, Rcpp::DataFrame trips, Rcpp::DataFrame stop_times);
+RcppExport SEXP _gtfsrouter_rcpp_network_write(SEXP engineSEXP, SEXP filenameSEXP, SEXP stopsSEXP, SEXP tripsSEXP, SEXP stop_timesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type stops(stopsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type trips(tripsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type stop_times(stop_timesSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_network_write(engine, filename, stops, trips, stop_times));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_network_read
+Rcpp::List rcpp_network_read(const std::string filename);
+RcppExport SEXP _gtfsrouter_rcpp_network_read(SEXP filenameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type filename(filenameSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_network_read(filename));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_network_tables
+Rcpp::List rcpp_network_tables(SEXP engine, const bool timetable);
+RcppExport SEXP _gtfsrouter_rcpp_network_tables(SEXP engineSEXP, SEXP timetableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const bool >::type timetable(timetableSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_network_tables(engine, timetable));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_csa_pareto
+Rcpp::DataFrame rcpp_csa_pareto(SEXP engine, const std::vector <size_t> start_stations, const std::vector <size_t> end_stations, const int start_time, const int max_transfers, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_csa_pareto(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP end_stationsSEXP, SEXP start_timeSEXP, SEXP max_transfersSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type end_stations(end_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time(start_timeSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_transfers(max_transfersSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_csa_pareto(engine, start_stations, end_stations, start_time, max_transfers, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_make_timetable
-Rcpp::DataFrame rcpp_make_timetable(Rcpp::DataFrame stop_times, std::vector <std::string> stop_ids, std::vector <std::string> trip_ids);
-RcppExport SEXP _gtfsrouter_rcpp_make_timetable(SEXP stop_timesSEXP, SEXP stop_idsSEXP, SEXP trip_idsSEXP) {
+Rcpp::DataFrame rcpp_make_timetable(Rcpp::DataFrame stop_times);
+RcppExport SEXP _gtfsrouter_rcpp_make_timetable(SEXP stop_timesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame >::type stop_times(stop_timesSEXP);
-    Rcpp::traits::input_parameter< std::vector <std::string> >::type stop_ids(stop_idsSEXP);
-    Rcpp::traits::input_parameter< std::vector <std::string> >::type trip_ids(trip_idsSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_make_timetable(stop_times, stop_ids, trip_ids));
+    rcpp_result_gen = Rcpp::wrap(rcpp_make_timetable(stop_times));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -77,6 +286,17 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_read_stop_times
+Rcpp::List rcpp_read_stop_times(const std::string filename);
+RcppExport SEXP _gtfsrouter_rcpp_read_stop_times(SEXP filenameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type filename(filenameSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_stop_times(filename));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_transfer_nbs
 Rcpp::List rcpp_transfer_nbs(Rcpp::DataFrame stops, const double dlim);
 RcppExport SEXP _gtfsrouter_rcpp_transfer_nbs(SEXP stopsSEXP, SEXP dlimSEXP) {
@@ -90,20 +310,57 @@ BEGIN_RCPP
 END_RCPP
 }
 // rcpp_traveltimes
-Rcpp::IntegerMatrix rcpp_traveltimes(Rcpp::DataFrame timetable, Rcpp::DataFrame transfers, const size_t nstations, const std::vector <size_t> start_stations, const int start_time_min, const int start_time_max, const bool minimise_transfers, const int max_traveltime);
-RcppExport SEXP _gtfsrouter_rcpp_traveltimes(SEXP timetableSEXP, SEXP transfersSEXP, SEXP nstationsSEXP, SEXP start_stationsSEXP, SEXP start_time_minSEXP, SEXP start_time_maxSEXP, SEXP minimise_transfersSEXP, SEXP max_traveltimeSEXP) {
+Rcpp::IntegerMatrix rcpp_traveltimes(SEXP engine, const std::vector <size_t> start_stations, const int start_time_min, const int start_time_max, const bool minimise_transfers, const int max_traveltime, const bool return_paths, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_traveltimes(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP start_time_minSEXP, SEXP start_time_maxSEXP, SEXP minimise_transfersSEXP, SEXP max_traveltimeSEXP, SEXP return_pathsSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type timetable(timetableSEXP);
-    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type transfers(transfersSEXP);
-    Rcpp::traits::input_parameter< const size_t >::type nstations(nstationsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
     Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
     Rcpp::traits::input_parameter< const int >::type start_time_min(start_time_minSEXP);
     Rcpp::traits::input_parameter< const int >::type start_time_max(start_time_maxSEXP);
     Rcpp::traits::input_parameter< const bool >::type minimise_transfers(minimise_transfersSEXP);
     Rcpp::traits::input_parameter< const int >::type max_traveltime(max_traveltimeSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_traveltimes(timetable, transfers, nstations, start_stations, start_time_min, start_time_max, minimise_transfers, max_traveltime));
+    Rcpp::traits::input_parameter< const bool >::type return_paths(return_pathsSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_traveltimes(engine, start_stations, start_time_min, start_time_max, minimise_transfers, max_traveltime, return_paths, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_traveltimes_percentiles
+Rcpp::IntegerMatrix rcpp_traveltimes_percentiles(SEXP engine, const std::vector <size_t> start_stations, const int start_time_min, const int start_time_max, const int max_traveltime, const std::vector <double> percentiles, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_traveltimes_percentiles(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP start_time_minSEXP, SEXP start_time_maxSEXP, SEXP max_traveltimeSEXP, SEXP percentilesSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< const std::vector <size_t> >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time_min(start_time_minSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time_max(start_time_maxSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_traveltime(max_traveltimeSEXP);
+    Rcpp::traits::input_parameter< const std::vector <double> >::type percentiles(percentilesSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_traveltimes_percentiles(engine, start_stations, start_time_min, start_time_max, max_traveltime, percentiles, service_day, trip_mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_traveltimes_matrix
+Rcpp::List rcpp_traveltimes_matrix(SEXP engine, Rcpp::List start_stations, const int start_time_min, const int start_time_max, const bool minimise_transfers, const int max_traveltime, const int service_day, Rcpp::LogicalVector trip_mask);
+RcppExport SEXP _gtfsrouter_rcpp_traveltimes_matrix(SEXP engineSEXP, SEXP start_stationsSEXP, SEXP start_time_minSEXP, SEXP start_time_maxSEXP, SEXP minimise_transfersSEXP, SEXP max_traveltimeSEXP, SEXP service_daySEXP, SEXP trip_maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type start_stations(start_stationsSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time_min(start_time_minSEXP);
+    Rcpp::traits::input_parameter< const int >::type start_time_max(start_time_maxSEXP);
+    Rcpp::traits::input_parameter< const bool >::type minimise_transfers(minimise_transfersSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_traveltime(max_traveltimeSEXP);
+    Rcpp::traits::input_parameter< const int >::type service_day(service_daySEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type trip_mask(trip_maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_traveltimes_matrix(engine, start_stations, start_time_min, start_time_max, minimise_transfers, max_traveltime, service_day, trip_mask));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -111,11 +368,29 @@ END_RCPP
 static const R_CallMethodDef CallEntries[] = {
     {"_gtfsrouter_rcpp_convert_time", (DL_FUNC) &_gtfsrouter_rcpp_convert_time, 1},
     {"_gtfsrouter_rcpp_time_to_seconds", (DL_FUNC) &_gtfsrouter_rcpp_time_to_seconds, 1},
-    {"_gtfsrouter_rcpp_make_timetable", (DL_FUNC) &_gtfsrouter_rcpp_make_timetable, 3},
+    {"_gtfsrouter_rcpp_csa_engine", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine, 4},
+    {"_gtfsrouter_rcpp_csa_engine_size", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_size, 1},
+    {"_gtfsrouter_rcpp_csa_engine_last_departure", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_last_departure, 1},
+    {"_gtfsrouter_rcpp_csa_engine_matches", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_matches, 3},
+    {"_gtfsrouter_rcpp_csa_engine_services", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_services, 3},
+    {"_gtfsrouter_rcpp_csa_engine_copy", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_copy, 1},
+    {"_gtfsrouter_rcpp_csa_engine_update", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_update, 4},
+    {"_gtfsrouter_rcpp_csa_engine_query", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_query, 7},
+    {"_gtfsrouter_rcpp_csa_engine_reverse", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_reverse, 8},
+    {"_gtfsrouter_rcpp_csa_engine_batch", (DL_FUNC) &_gtfsrouter_rcpp_csa_engine_batch, 7},
+    {"_gtfsrouter_rcpp_csa_profile", (DL_FUNC) &_gtfsrouter_rcpp_csa_profile, 7},
+    {"_gtfsrouter_rcpp_network_write", (DL_FUNC) &_gtfsrouter_rcpp_network_write, 5},
+    {"_gtfsrouter_rcpp_network_read", (DL_FUNC) &_gtfsrouter_rcpp_network_read, 1},
+    {"_gtfsrouter_rcpp_network_tables", (DL_FUNC) &_gtfsrouter_rcpp_network_tables, 2},
+    {"_gtfsrouter_rcpp_csa_pareto", (DL_FUNC) &_gtfsrouter_rcpp_csa_pareto, 7},
+    {"_gtfsrouter_rcpp_make_timetable", (DL_FUNC) &_gtfsrouter_rcpp_make_timetable, 1},
     {"_gtfsrouter_rcpp_csa", (DL_FUNC) &_gtfsrouter_rcpp_csa, 8},
     {"_gtfsrouter_rcpp_freq_to_stop_times", (DL_FUNC) &_gtfsrouter_rcpp_freq_to_stop_times, 4},
+    {"_gtfsrouter_rcpp_read_stop_times", (DL_FUNC) &_gtfsrouter_rcpp_read_stop_times, 1},
     {"_gtfsrouter_rcpp_transfer_nbs", (DL_FUNC) &_gtfsrouter_rcpp_transfer_nbs, 2},
-    {"_gtfsrouter_rcpp_traveltimes", (DL_FUNC) &_gtfsrouter_rcpp_traveltimes, 8},
+    {"_gtfsrouter_rcpp_traveltimes", (DL_FUNC) &_gtfsrouter_rcpp_traveltimes, 9},
+    {"_gtfsrouter_rcpp_traveltimes_percentiles", (DL_FUNC) &_gtfsrouter_rcpp_traveltimes_percentiles, 8},
+    {"_gtfsrouter_rcpp_traveltimes_matrix", (DL_FUNC) &_gtfsrouter_rcpp_traveltimes_matrix, 8},
     {NULL, NULL, 0}
 };
 
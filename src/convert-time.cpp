@@ -102,32 +102,111 @@ int rcpp_convert_time (const std::string &hms)
 
 // ----------  Vector conversion of GTFS times:  ----------
 
-int convert_time_to_seconds (std::string hms)
+// Fixed-width "HH:MM:SS" times are parsed as a single 64-bit word, with all
+// digits and separators validated at once. Bytes are assembled in
+// little-endian order regardless of platform, which compilers reduce to a
+// single load on little-endian systems. Returns false for any other format.
+bool convert_time_hhmmss_swar (const char *hms, int &res)
 {
-    const std::string delim = ":";
-    unsigned int ipos = static_cast <unsigned int> (hms.find (delim.c_str ()));
-    int h = atoi (hms.substr (0, ipos).c_str ());
-    hms = hms.substr (ipos + 1, hms.length () - ipos - 1);
-    ipos = static_cast <unsigned int> (hms.find (delim.c_str ()));
-    int m = atoi (hms.substr (0, ipos).c_str ());
-    int s = atoi (hms.substr (ipos + 1, hms.length ()).c_str ());
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | static_cast <unsigned char> (hms [i]);
+
+    // Digits at bytes 0, 1, 3, 4, 6, 7, and separators at bytes 2 and 5:
+    const uint64_t digits = 0xFFFF00FFFF00FFFFULL;
+    const uint64_t zeros = 0x3030303030303030ULL;
+    if ((v & ~digits) != 0x00003A00003A0000ULL ||
+            (v & 0xF0F0F0F0F0F0F0F0ULL & digits) != (zeros & digits) ||
+            ((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL & digits) !=
+                (zeros & digits))
+        return false;
+
+    // Combine pairs of digits into bytes 0, 3, and 6:
+    const uint64_t d = (v - zeros) & digits;
+    const uint64_t t = d * 10 + (d >> 8);
+    res = 3600 * static_cast <int> (t & 0xFF) +
+        60 * static_cast <int> ((t >> 24) & 0xFF) +
+        static_cast <int> ((t >> 48) & 0xFF);
+
+    return true;
+}
 
-    return 3600 * h + 60 * m + s;
+// Convert GTFS times of "H:MM:SS" or "HH:MM:SS", including hours beyond 24, to
+// seconds. Other formats are parsed component-wise like `atoi`, ignoring
+// leading spaces, with missing components of zero, so empty times are zero.
+int convert_time_to_seconds (const char *hms, const size_t len)
+{
+    int res;
+    if (len == 8 && convert_time_hhmmss_swar (hms, res))
+        return res;
+    if (len == 7)
+    {
+        char buf [8] = { '0' };
+        std::memcpy (buf + 1, hms, 7L);
+        if (convert_time_hhmmss_swar (buf, res))
+            return res;
+    }
+
+    const char *p = hms, *end = hms + len;
+    const int multiplier [3] = { 3600, 60, 1 };
+    res = 0;
+    for (int component = 0; component < 3 && p < end; component++)
+    {
+        while (p < end && *p == ' ')
+            p++;
+        int value = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            value = 10 * value + (*p++ - '0');
+        res += multiplier [component] * value;
+
+        while (p < end && *p != ':')
+            p++;
+        if (p < end)
+            p++;
+    }
+
+    return res;
 }
 
 //' rcpp_time_to_seconds
 //'
-//' Vectorize the above function
+//' Vectorize the above function, reading the bytes of each R string directly,
+//' with chunks of strings converted in parallel. `NA` values remain `NA`.
 //'
 //' @noRd
 // [[Rcpp::export]]
-Rcpp::IntegerVector rcpp_time_to_seconds (std::vector <std::string> times)
+Rcpp::IntegerVector rcpp_time_to_seconds (Rcpp::CharacterVector times)
 {
-    Rcpp::IntegerVector res (times.size ());
-    for (size_t i = 0; i < times.size (); i++)
+    const R_xlen_t n = times.size ();
+    Rcpp::IntegerVector res (n);
+    int *out = res.begin ();
+
+    // The characters and lengths of all strings are obtained through the R
+    // API before threads are started, with null pointers for NA values, so
+    // threads only read plain arrays:
+    const SEXP *t = STRING_PTR_RO (times);
+    std::vector <const char *> chars (static_cast <size_t> (n));
+    std::vector <size_t> lens (static_cast <size_t> (n));
+    for (R_xlen_t i = 0; i < n; i++)
+    {
+        if (t [i] == NA_STRING)
+        {
+            chars [i] = nullptr;
+        } else
+        {
+            chars [i] = CHAR (t [i]);
+            lens [i] = static_cast <size_t> (LENGTH (t [i]));
+        }
+    }
+
+    #pragma omp parallel for schedule(static, TIME_CHUNK_SIZE)
+    for (R_xlen_t i = 0; i < n; i++)
     {
-        res (i) = convert_time_to_seconds (times [i]);
+        if (chars [i] == nullptr)
+            out [i] = NA_INTEGER;
+        else
+            out [i] = convert_time_to_seconds (chars [i], lens [i]);
     }
+
     return res;
 }
-
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <algorithm> // std::count
+#include <cstdint>
+#include <cstring> // memcpy
 #include <cmath> // floor
 #include <stdexcept>
 #include <time.h>
@@ -18,5 +20,9 @@ int convert_time_lubridate (std::string hms);
 int rcpp_convert_time (const std::string &hms);
 
 // ----------  Vector conversion of GTFS times:  ----------
-int convert_time_to_seconds (std::string hms);
-Rcpp::IntegerVector rcpp_time_to_seconds (std::vector <std::string> times);
+// Number of times converted by each thread at once:
+constexpr R_xlen_t TIME_CHUNK_SIZE = 4096;
+
+bool convert_time_hhmmss_swar (const char *hms, int &res);
+int convert_time_to_seconds (const char *hms, const size_t len);
+Rcpp::IntegerVector rcpp_time_to_seconds (Rcpp::CharacterVector times);
@@ -0,0 +1,584 @@
+#include "csa.h"
+
+#include <algorithm> // any_of
+#include <numeric> // iota
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//' rcpp_csa_engine
+//'
+//' Construct a compiled routing engine from a timetable and transfer table,
+//' both in the same form as submitted to `rcpp_csa`. The engine holds the
+//' converted and range-checked inputs, along with output vectors which are
+//' re-used for each query, and is returned as an external pointer.
+//'
+//' @noRd
+// [[Rcpp::export]]
+SEXP rcpp_csa_engine (Rcpp::DataFrame timetable,
+        Rcpp::DataFrame transfers,
+        const size_t nstations,
+        const size_t ntrips)
+{
+    CSA_Engine *engine = new CSA_Engine (nstations, ntrips);
+
+    try {
+        csa::make_transfer_map (engine->csa_in.transfer_map, transfers, nstations);
+        csa::csa_in_from_df (timetable, engine->csa_in);
+        csa::check_csa_inputs (engine->csa_in, nstations, ntrips);
+        csa::transpose_transfer_graph (engine->csa_in.transfer_map,
+                engine->transfers_in);
+        Rcpp::List columns = csa::input_columns (timetable, transfers);
+        engine->fingerprint = csa::inputs_fingerprint (columns);
+        engine->hold_input_columns (columns);
+    } catch (...) {
+        delete engine;
+        throw;
+    }
+
+    Rcpp::XPtr <CSA_Engine> ptr (engine, true);
+
+    return ptr;
+}
+
+//' rcpp_csa_engine_size
+//'
+//' @return Number of connections held in an engine, or -1 if the engine is no
+//' longer valid, which happens for example when it has been serialized and
+//' reloaded.
+//'
+//' @noRd
+// [[Rcpp::export]]
+int rcpp_csa_engine_size (SEXP engine)
+{
+    Rcpp::XPtr <CSA_Engine> ptr (engine);
+    if (ptr.get () == nullptr)
+        return -1L;
+
+    return static_cast <int> (ptr->csa_in.departure_time.size ());
+}
+
+//' rcpp_csa_engine_last_departure
+//'
+//' @return Departure time of the last connection of an engine, which holds
+//' connections sorted by departure time, or `NA` if there are none.
+//'
+//' @noRd
+// [[Rcpp::export]]
+int rcpp_csa_engine_last_departure (SEXP engine)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const NetworkArray <int> &departure_time = ptr->csa_in.departure_time;
+    if (departure_time.empty ())
+        return NA_INTEGER;
+
+    return departure_time [departure_time.size () - 1L];
+}
+
+//' rcpp_csa_engine_matches
+//'
+//' @return `TRUE` if the engine is valid and was compiled from the given
+//' timetable and transfers, otherwise `FALSE`. The checksum of the tables is
+//' only re-calculated when their columns are not the same objects as those
+//' last checked, so repeated queries on one feed do not re-read the
+//' timetable.
+//'
+//' @noRd
+// [[Rcpp::export]]
+bool rcpp_csa_engine_matches (SEXP engine,
+        Rcpp::DataFrame timetable,
+        Rcpp::DataFrame transfers)
+{
+    Rcpp::XPtr <CSA_Engine> ptr (engine);
+    if (ptr.get () == nullptr)
+        return false;
+
+    Rcpp::List columns = csa::input_columns (timetable, transfers);
+    if (csa::same_columns (ptr->input_columns, columns))
+        return true;
+    if (csa::inputs_fingerprint (columns) != ptr->fingerprint)
+        return false;
+
+    ptr->hold_input_columns (columns);
+
+    return true;
+}
+
+// External pointers are null after serialization and reloading:
+Rcpp::XPtr <CSA_Engine> engine_ptr (SEXP engine)
+{
+    Rcpp::XPtr <CSA_Engine> ptr (engine);
+    if (ptr.get () == nullptr)
+        Rcpp::stop ("routing engine is no longer valid; please re-create it");
+
+    return ptr;
+}
+
+//' rcpp_csa_engine_services
+//'
+//' Add days of operation of each trip to an engine compiled from all trips of
+//' a feed. `trip_service` holds 1-based row indices into `service_days` for
+//' each trip, or NA for trips with no service, and `service_days` has one
+//' column for each day of the service calendar. Replaces any previous days.
+//'
+//' @noRd
+// [[Rcpp::export]]
+void rcpp_csa_engine_services (SEXP engine,
+        const std::vector <int> trip_service,
+        Rcpp::LogicalMatrix service_days)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    if (trip_service.size () != ptr->ntrips)
+        Rcpp::stop ("trip_service must have one value for each trip");
+
+    const int nservices = service_days.nrow ();
+    TripServices &services = ptr->services;
+    services.ndays = static_cast <size_t> (service_days.ncol ());
+    // Trips are 1-based:
+    services.nwords = (ptr->ntrips + 64L) / 64L;
+    services.bits.assign (services.ndays * services.nwords, 0L);
+
+    for (size_t t = 0; t < trip_service.size (); t++)
+    {
+        const int s = trip_service [t];
+        if (s == NA_INTEGER || s < 1 || s > nservices)
+            continue;
+
+        const size_t trip = t + 1L;
+        for (size_t d = 0; d < services.ndays; d++)
+            if (service_days (s - 1, d) == TRUE)
+                services.bits [d * services.nwords + (trip >> 6)] |=
+                    (uint64_t (1) << (trip & 63));
+    }
+}
+
+// Active trips for queries on 'service_day', where negative days use all
+// trips. Cancelled trips, and those not in any non-empty 'trip_mask' of one
+// logical value per trip, are removed from the active trips of each query,
+// which is a single pass over one bit per trip. Scans then skip all inactive
+// trips with one bit test, so queries on any subset of trips share the same
+// engine.
+const uint64_t *engine_trip_active (
+        CSA_Engine &engine,
+        const int service_day,
+        const Rcpp::LogicalVector &trip_mask)
+{
+    if (service_day >= 0 &&
+            static_cast <size_t> (service_day) >= engine.services.ndays)
+        Rcpp::stop ("service_day is not in the service calendar of the engine");
+
+    const size_t nmask = static_cast <size_t> (trip_mask.size ());
+    if (nmask > 0 && nmask != engine.ntrips)
+        Rcpp::stop ("trip_mask must have one value for each trip of the engine");
+
+    const uint64_t *active = engine.services.day (service_day);
+    if (engine.cancelled.empty () && nmask == 0)
+        return active;
+
+    const size_t nwords = (engine.ntrips + 64L) / 64L;
+    if (active == nullptr)
+        engine.trip_active.assign (nwords, ~uint64_t (0));
+    else
+        engine.trip_active.assign (active, active + nwords);
+
+    if (!engine.cancelled.empty ())
+        for (size_t i = 0; i < nwords; i++)
+            engine.trip_active [i] &= ~engine.cancelled [i];
+
+    for (size_t t = 1; t <= nmask; t++)
+        if (trip_mask [t - 1] != TRUE)
+            engine.trip_active [t >> 6] &= ~(uint64_t (1) << (t & 63));
+
+    return engine.trip_active.data ();
+}
+
+//' rcpp_csa_engine_copy
+//'
+//' Copy an engine, so that updates of the copy do not affect the engines of
+//' any other copies of the same timetable. Copies share all arrays of
+//' connections and transfers with the original engine, including those of
+//' mapped network files, and arrays are only copied when an update modifies
+//' them while they are still shared.
+//'
+//' @noRd
+// [[Rcpp::export]]
+SEXP rcpp_csa_engine_copy (SEXP engine)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    CSA_Engine *copy = new CSA_Engine (*ptr);
+    // Outputs of batch queries are re-allocated as needed:
+    copy->thread_out.clear ();
+
+    Rcpp::XPtr <CSA_Engine> ptr_copy (copy, true);
+
+    return ptr_copy;
+}
+
+//' rcpp_csa_engine_update
+//'
+//' Apply real-time delays and cancellations to trips of a compiled engine.
+//' `trips` are 1-based, and `delays` are in seconds relative to the original
+//' timetable, so replace any previous delays of the same trips. `cancelled`
+//' flags trips which do not operate, while values of `FALSE` reinstate any
+//' previously cancelled trips. Connections of trips with changed delays are
+//' shifted and merged back into the existing order, so the timetable does not
+//' need to be re-constructed.
+//'
+//' @return The number of connections which were shifted.
+//'
+//' @noRd
+// [[Rcpp::export]]
+int rcpp_csa_engine_update (SEXP engine,
+        const std::vector <int> trips,
+        const std::vector <int> delays,
+        Rcpp::LogicalVector cancelled)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    CSA_Engine &eng = *ptr;
+
+    const size_t n = trips.size ();
+    if (delays.size () != n || static_cast <size_t> (cancelled.size ()) != n)
+        Rcpp::stop ("trips, delays, and cancelled must have the same length");
+    for (auto t: trips)
+        if (t < 1 || static_cast <size_t> (t) > eng.ntrips)
+            Rcpp::stop ("Trip in wrong range.");
+
+    if (eng.trip_delay.empty ())
+        eng.trip_delay.assign (eng.ntrips + 1, 0L);
+
+    const size_t nwords = (eng.ntrips + 64L) / 64L;
+    std::vector <uint64_t> cancel_bits (eng.cancelled);
+    cancel_bits.resize (nwords, 0L);
+
+    std::vector <int> shift (eng.ntrips + 1, 0L);
+    for (size_t i = 0; i < n; i++)
+    {
+        const size_t t = static_cast <size_t> (trips [i]);
+        const int delay = (delays [i] == NA_INTEGER) ? 0L : delays [i];
+        shift [t] += delay - eng.trip_delay [t];
+        eng.trip_delay [t] = delay;
+
+        const uint64_t bit = uint64_t (1) << (t & 63);
+        if (cancelled [i] == TRUE)
+            cancel_bits [t >> 6] |= bit;
+        else
+            cancel_bits [t >> 6] &= ~bit;
+    }
+
+    if (std::any_of (cancel_bits.begin (), cancel_bits.end (),
+                [] (const uint64_t b) { return b != 0; }))
+        eng.cancelled = std::move (cancel_bits);
+    else
+        eng.cancelled.clear ();
+
+    const size_t nshifted = csa::shift_trips (eng.csa_in, shift);
+
+    return static_cast <int> (nshifted);
+}
+
+void check_engine_stations (
+        const std::vector <size_t> &stations,
+        const size_t nstations,
+        const std::string &type)
+{
+    for (auto s: stations)
+        if (s > nstations)
+            Rcpp::stop (type + " station in wrong range.");
+}
+
+//' rcpp_csa_engine_query
+//'
+//' Route between start and end stations using a compiled engine. Returns the
+//' same result as `rcpp_csa` would for the timetable and transfers used to
+//' construct the engine.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_csa_engine_query (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    check_engine_stations (start_stations, ptr->nstations, "Start");
+    check_engine_stations (end_stations, ptr->nstations, "End");
+
+    CSA_Parameters csa_pars;
+    csa::fill_csa_pars (csa_pars, max_transfers, start_time,
+            ptr->csa_in.departure_time.size (), ptr->ntrips, ptr->nstations);
+    csa_pars.trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    ptr->csa_out.reset ();
+
+    return csa::route_query (csa_pars, ptr->csa_in, ptr->csa_out,
+            start_stations, end_stations);
+}
+
+//' rcpp_csa_engine_reverse
+//'
+//' Latest-departure routing query using a compiled engine, for journeys from
+//' `start_stations` to `end_stations` departing at or after `start_time` and
+//' arriving no later than `arrival_time`. The connections are scanned in
+//' reverse, so the result has the same form as that of `rcpp_csa` applied to a
+//' timetable reversed in both direction and time, starting from
+//' `end_stations`: rows run from the start station back to the end station,
+//' and times are in seconds prior to `arrival_time`.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_csa_engine_reverse (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int arrival_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    check_engine_stations (start_stations, ptr->nstations, "Start");
+    check_engine_stations (end_stations, ptr->nstations, "End");
+
+    CSA_Parameters csa_pars;
+    csa::fill_csa_pars (csa_pars, max_transfers, start_time,
+            ptr->csa_in.departure_time.size (), ptr->ntrips, ptr->nstations);
+    csa_pars.trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    ptr->csa_out.reset ();
+
+    std::vector <size_t> end_station_out, trip_out;
+    std::vector <int> time_out;
+
+    csa::route_query_vectors_reverse (csa_pars, ptr->csa_in, ptr->csa_out,
+            start_stations, end_stations, arrival_time,
+            end_station_out, trip_out, time_out);
+
+    Rcpp::DataFrame res = Rcpp::DataFrame::create (
+            Rcpp::Named ("stop_number") = end_station_out,
+            Rcpp::Named ("time") = time_out,
+            Rcpp::Named ("trip_number") = trip_out,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    return res;
+}
+
+//' rcpp_csa_engine_batch
+//'
+//' Route between multiple pairs of start and end stations using a compiled
+//' engine, with queries run in parallel. `start_stations` and `end_stations`
+//' are lists of integer vectors with one item for each query, and
+//' `start_times` has one value per query. Results of all queries are returned
+//' in a single DataFrame, with an additional "query" column of 1-based indices
+//' into the input lists. Queries for which no route is found have no rows.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_csa_engine_batch (SEXP engine,
+        Rcpp::List start_stations,
+        Rcpp::List end_stations,
+        const std::vector <int> start_times,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    const size_t nqueries = start_times.size ();
+    if (static_cast <size_t> (start_stations.size ()) != nqueries ||
+            static_cast <size_t> (end_stations.size ()) != nqueries)
+        Rcpp::stop ("start_stations, end_stations, and start_times must have the same length");
+
+    // Conversion from R objects must be done before threads are started:
+    std::vector <std::vector <size_t> > starts (nqueries), ends (nqueries);
+    for (size_t i = 0; i < nqueries; i++)
+    {
+        starts [i] = Rcpp::as <std::vector <size_t> > (start_stations [i]);
+        ends [i] = Rcpp::as <std::vector <size_t> > (end_stations [i]);
+        check_engine_stations (starts [i], ptr->nstations, "Start");
+        check_engine_stations (ends [i], ptr->nstations, "End");
+    }
+
+    const CSA_Engine &eng = *ptr;
+    const size_t timetable_size = eng.csa_in.departure_time.size ();
+    const uint64_t *trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    std::vector <std::vector <size_t> > stn_out (nqueries), trip_out (nqueries);
+    std::vector <std::vector <int> > time_out (nqueries);
+    std::string err_msg;
+
+    // Outputs for each thread are held in the engine, and only reset between
+    // queries:
+    size_t nthreads = 1;
+#ifdef _OPENMP
+    nthreads = static_cast <size_t> (omp_get_max_threads ());
+#endif
+    while (ptr->thread_out.size () < nthreads)
+        ptr->thread_out.emplace_back (eng.nstations + 1, eng.ntrips + 1);
+
+    #pragma omp parallel
+    {
+        size_t thread = 0;
+#ifdef _OPENMP
+        thread = static_cast <size_t> (omp_get_thread_num ());
+#endif
+        CSA_Outputs &csa_out = ptr->thread_out [thread];
+
+        #pragma omp for schedule(dynamic)
+        for (size_t i = 0; i < nqueries; i++)
+        {
+            CSA_Parameters csa_pars;
+            csa::fill_csa_pars (csa_pars, max_transfers, start_times [i],
+                    timetable_size, eng.ntrips, eng.nstations);
+            csa_pars.trip_active = trip_active;
+
+            csa_out.reset ();
+            try {
+                csa::route_query_vectors (csa_pars, eng.csa_in, csa_out,
+                        starts [i], ends [i],
+                        stn_out [i], trip_out [i], time_out [i]);
+            } catch (const std::exception &e) { // # nocov start
+                #pragma omp critical
+                err_msg = e.what ();
+            } // # nocov end
+        }
+    }
+
+    if (!err_msg.empty ())
+        Rcpp::stop (err_msg); // # nocov
+
+    size_t nrows = 0;
+    for (const auto &s: stn_out)
+        nrows += s.size ();
+
+    std::vector <int> query (nrows), time (nrows);
+    std::vector <size_t> stop_number (nrows), trip_number (nrows);
+    size_t pos = 0;
+    for (size_t i = 0; i < nqueries; i++)
+    {
+        std::fill (query.begin () + pos,
+                query.begin () + pos + stn_out [i].size (),
+                static_cast <int> (i + 1));
+        std::copy (stn_out [i].begin (), stn_out [i].end (),
+                stop_number.begin () + pos);
+        std::copy (time_out [i].begin (), time_out [i].end (),
+                time.begin () + pos);
+        std::copy (trip_out [i].begin (), trip_out [i].end (),
+                trip_number.begin () + pos);
+        pos += stn_out [i].size ();
+    }
+
+    Rcpp::DataFrame res = Rcpp::DataFrame::create (
+            Rcpp::Named ("query") = query,
+            Rcpp::Named ("stop_number") = stop_number,
+            Rcpp::Named ("time") = time,
+            Rcpp::Named ("trip_number") = trip_number,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    return res;
+}
+
+//' rcpp_csa_profile
+//'
+//' Profile Connection Scan using a compiled engine, giving all Pareto-optimal
+//' pairs of departure and earliest arrival times for journeys to any of
+//' `end_stations`, departing between `start_time` and (before) `end_time`,
+//' from a single scan of the timetable. If `start_stations` are given, a
+//' single profile is returned for journeys starting from any of those, or any
+//' stations with transfers from those, with "stop_number" holding the actual
+//' station of departure. If `start_stations` is empty, profiles are returned
+//' for all stations. Profiles are sorted by increasing departure time.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_csa_profile (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int end_time,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    check_engine_stations (start_stations, ptr->nstations, "Start");
+    check_engine_stations (end_stations, ptr->nstations, "End");
+
+    const uint64_t *trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    const TransferGraph &transfer_map = ptr->csa_in.transfer_map;
+
+    // Transfers from start stations are not penalised, as in rcpp_csa:
+    std::vector <bool> is_source (ptr->nstations + 1, false);
+    for (auto s: start_stations)
+    {
+        is_source [s] = true;
+        for (size_t k = transfer_map.begin (s); k < transfer_map.end (s); k++)
+            is_source [transfer_map.dest [k]] = true;
+    }
+
+    std::vector <ProfileType> profiles;
+    std::vector <size_t> source_stn;
+    std::vector <int> source_dep, source_arr;
+
+    csa::profile_scan (ptr->csa_in, ptr->transfers_in, ptr->nstations,
+            ptr->ntrips, end_stations, start_time, is_source, trip_active,
+            profiles, source_stn, source_dep, source_arr);
+
+    std::vector <size_t> stop_number;
+    std::vector <int> departure_time, arrival_time;
+
+    if (start_stations.size () > 0)
+    {
+        // Reduce source connections to a single Pareto set:
+        std::vector <size_t> index (source_dep.size ());
+        std::iota (index.begin (), index.end (), 0L);
+        std::sort (index.begin (), index.end (),
+                [&] (const size_t a, const size_t b) {
+                    return source_dep [a] > source_dep [b] ||
+                        (source_dep [a] == source_dep [b] &&
+                         source_arr [a] < source_arr [b]);
+                });
+        int best_arrival = INFINITE_INT;
+        for (auto i: index)
+        {
+            if (source_arr [i] >= best_arrival)
+                continue;
+            best_arrival = source_arr [i];
+            if (source_dep [i] < end_time)
+            {
+                stop_number.push_back (source_stn [i]);
+                departure_time.push_back (source_dep [i]);
+                arrival_time.push_back (source_arr [i]);
+            }
+        }
+        std::reverse (stop_number.begin (), stop_number.end ());
+        std::reverse (departure_time.begin (), departure_time.end ());
+        std::reverse (arrival_time.begin (), arrival_time.end ());
+    } else
+    {
+        for (size_t s = 1; s < profiles.size (); s++)
+            for (auto p = profiles [s].rbegin (); p != profiles [s].rend (); p++)
+                if (p->first >= start_time && p->first < end_time)
+                {
+                    stop_number.push_back (s);
+                    departure_time.push_back (p->first);
+                    arrival_time.push_back (p->second);
+                }
+    }
+
+    Rcpp::DataFrame res = Rcpp::DataFrame::create (
+            Rcpp::Named ("stop_number") = stop_number,
+            Rcpp::Named ("departure_time") = departure_time,
+            Rcpp::Named ("arrival_time") = arrival_time,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    return res;
+}
@@ -0,0 +1,475 @@
+#include "csa.h"
+
+#include <cstring> // memcpy, strncmp
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Files are mapped read-only and shared, so all processes reading the same
+// file share the same physical pages. Mapping is not available on Windows, on
+// which files are instead read into memory.
+NetworkFile::NetworkFile (const std::string &filename)
+{
+#ifndef _WIN32
+    const int fd = open (filename.c_str (), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error ("Unable to open network file " + filename);
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size == 0)
+    {
+        close (fd);
+        throw std::runtime_error ("Unable to read network file " + filename);
+    }
+    nbytes = static_cast <size_t> (st.st_size);
+
+    void *addr = mmap (nullptr, nbytes, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error ("Unable to map network file " + filename);
+
+    mapped = static_cast <const char *> (addr);
+#else
+    std::ifstream in (filename, std::ios::binary);
+    if (!in)
+        throw std::runtime_error ("Unable to open network file " + filename);
+    buffer.assign (std::istreambuf_iterator <char> (in),
+            std::istreambuf_iterator <char> ());
+    nbytes = buffer.size ();
+    mapped = buffer.data ();
+#endif
+}
+
+NetworkFile::~NetworkFile ()
+{
+#ifndef _WIN32
+    if (mapped != nullptr)
+        munmap (const_cast <char *> (mapped), nbytes);
+#endif
+}
+
+// Arrays in network files are padded to multiples of 8 bytes.
+size_t network::array_bytes (
+        const size_t n,
+        const size_t size)
+{
+    return ((n * size + 7L) / 8L) * 8L;
+}
+
+// Missing values in dictionaries are written as this string, which is not
+// valid UTF-8, so never a value itself:
+constexpr char NETWORK_NA [] = "\xff";
+
+// Dictionaries are 'n' consecutive nul-terminated strings.
+Rcpp::CharacterVector network::read_dictionary (
+        const char *data,
+        const size_t size,
+        const size_t n)
+{
+    Rcpp::CharacterVector res (n);
+
+    const char *p = data, *end = data + size;
+    size_t i = 0;
+    while (p < end && i < n)
+    {
+        const size_t len = strnlen (p, static_cast <size_t> (end - p));
+        if (std::strcmp (p, NETWORK_NA) == 0)
+            res [i++] = NA_STRING;
+        else
+            res [i++] = std::string (p, len);
+        p += len + 1;
+    }
+    if (i != n)
+        Rcpp::stop ("Network file has corrupt dictionaries");
+
+    return res;
+}
+
+// Offsets must index within the transfers, and destinations within the
+// stations, as both are used directly to index arrays.
+void network::check_transfer_graph (
+        const TransferGraph &graph,
+        const size_t nstations,
+        const size_t ntransfers)
+{
+    if (graph.offsets [0] != 0 || graph.offsets [nstations + 1L] != ntransfers)
+        Rcpp::stop ("Network file has corrupt transfers");
+    for (size_t s = 1; s <= nstations + 1L; s++)
+        if (graph.offsets [s] < graph.offsets [s - 1] ||
+                graph.offsets [s] > ntransfers)
+            Rcpp::stop ("Network file has corrupt transfers");
+    for (size_t k = 0; k < ntransfers; k++)
+        if (graph.dest [k] > nstations)
+            Rcpp::stop ("Network file has corrupt transfers");
+}
+
+// Point an array at the next 'n' values of a network file, and advance 'pos'
+// beyond them.
+template <typename T>
+void view_network_array (
+        NetworkArray <T> &array,
+        const NetworkFile &file,
+        size_t &pos,
+        const size_t n)
+{
+    array.view (reinterpret_cast <const T *> (file.data () + pos), n);
+    pos += network::array_bytes (n, sizeof (T));
+}
+
+// Copy the next 'n' values of a network file to an R vector, and advance 'pos'
+// beyond them.
+template <typename T>
+std::vector <int> read_network_array (
+        const NetworkFile &file,
+        size_t &pos,
+        const size_t n)
+{
+    const T *first = reinterpret_cast <const T *> (file.data () + pos);
+    pos += network::array_bytes (n, sizeof (T));
+
+    return std::vector <int> (first, first + n);
+}
+
+template <typename T>
+void write_network_array (
+        std::ofstream &out,
+        const T *data,
+        const size_t n)
+{
+    const size_t nbytes = n * sizeof (T);
+    out.write (reinterpret_cast <const char *> (data),
+            static_cast <std::streamsize> (nbytes));
+    const std::vector <char> padding (network::array_bytes (n, sizeof (T)) -
+            nbytes, 0);
+    out.write (padding.data (), static_cast <std::streamsize> (padding.size ()));
+}
+
+void write_transfer_graph (
+        std::ofstream &out,
+        const TransferGraph &graph)
+{
+    write_network_array (out, graph.offsets.data (), graph.offsets.size ());
+    write_network_array (out, graph.dest.data (), graph.dest.size ());
+    write_network_array (out, graph.duration.data (), graph.duration.size ());
+}
+
+// Consecutive nul-terminated strings of a dictionary, as written to file.
+std::vector <char> network_dictionary (Rcpp::CharacterVector dict)
+{
+    std::vector <char> buffer;
+    const SEXP *d = STRING_PTR_RO (dict);
+    for (R_xlen_t i = 0; i < dict.size (); i++)
+    {
+        const char *di = (d [i] == NA_STRING) ? NETWORK_NA : CHAR (d [i]);
+        buffer.insert (buffer.end (), di, di + std::strlen (di));
+        buffer.push_back ('\0');
+    }
+
+    return buffer;
+}
+
+// The timetable of an engine, in the same form as those of feeds processed by
+// `gtfs_timetable`.
+Rcpp::DataFrame network_timetable (const CSA_Engine &eng)
+{
+    const CSA_Inputs &csa_in = eng.csa_in;
+
+    return Rcpp::DataFrame::create (
+            Rcpp::Named ("departure_station") = std::vector <int> (
+                csa_in.departure_station.begin (),
+                csa_in.departure_station.end ()),
+            Rcpp::Named ("arrival_station") = std::vector <int> (
+                csa_in.arrival_station.begin (),
+                csa_in.arrival_station.end ()),
+            Rcpp::Named ("departure_time") = std::vector <int> (
+                csa_in.departure_time.begin (),
+                csa_in.departure_time.end ()),
+            Rcpp::Named ("arrival_time") = std::vector <int> (
+                csa_in.arrival_time.begin (),
+                csa_in.arrival_time.end ()),
+            Rcpp::Named ("trip_id") = std::vector <int> (
+                csa_in.trip_id.begin (),
+                csa_in.trip_id.end ()),
+            Rcpp::_["stringsAsFactors"] = false);
+}
+
+// The transfers of an engine, in the order of the transfer graph.
+Rcpp::DataFrame network_transfers (const CSA_Engine &eng)
+{
+    const TransferGraph &tr = eng.csa_in.transfer_map;
+    std::vector <int> from_stop_id, to_stop_id;
+    from_stop_id.reserve (tr.dest.size ());
+    to_stop_id.reserve (tr.dest.size ());
+    for (size_t s = 0; s <= eng.nstations; s++)
+        for (size_t k = tr.begin (s); k < tr.end (s); k++)
+        {
+            from_stop_id.push_back (static_cast <int> (s));
+            to_stop_id.push_back (static_cast <int> (tr.dest [k]));
+        }
+
+    return Rcpp::DataFrame::create (
+            Rcpp::Named ("from_stop_id") = from_stop_id,
+            Rcpp::Named ("to_stop_id") = to_stop_id,
+            Rcpp::Named ("min_transfer_time") = std::vector <int> (
+                tr.duration.begin (), tr.duration.end ()),
+            Rcpp::_["stringsAsFactors"] = false);
+}
+
+//' rcpp_network_write
+//'
+//' Write the connections and transfers of a compiled engine to a binary
+//' network file, along with the stop and trip data needed to route on the
+//' network without the feed from which it was compiled. `stops` has the
+//' "stop_id" and "stop_name" of each station, `trips` has the "trip_id",
+//' "route_id", "route_short_name", and "trip_headsign" of each trip, and
+//' `stop_times` has the 1-based "trip" and "stop" numbers, along with the
+//' "arrival_time" and "departure_time" in seconds, of all stop times.
+//'
+//' @noRd
+// [[Rcpp::export]]
+void rcpp_network_write (SEXP engine,
+        const std::string filename,
+        Rcpp::DataFrame stops,
+        Rcpp::DataFrame trips,
+        Rcpp::DataFrame stop_times)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const CSA_Engine &eng = *ptr;
+    const CSA_Inputs &csa_in = eng.csa_in;
+
+    if (static_cast <size_t> (stops.nrow ()) != eng.nstations ||
+            static_cast <size_t> (trips.nrow ()) != eng.ntrips)
+        Rcpp::stop ("stops and trips must match stations and trips of engine");
+    if (eng.transfers_in.dest.size () != csa_in.transfer_map.dest.size ())
+        Rcpp::stop ("Transfers of engine are inconsistent"); // # nocov
+    if (sizeof (size_t) != sizeof (uint64_t))
+        Rcpp::stop ("Network files can only be written on 64-bit systems"); // # nocov
+
+    const std::vector <int> st_trip = stop_times ["trip"],
+        st_stop = stop_times ["stop"],
+        st_arrival = stop_times ["arrival_time"],
+        st_departure = stop_times ["departure_time"];
+    for (size_t i = 0; i < st_trip.size (); i++)
+        if (st_trip [i] < 1 || st_stop [i] < 1 ||
+                static_cast <size_t> (st_trip [i]) > eng.ntrips ||
+                static_cast <size_t> (st_stop [i]) > eng.nstations)
+            Rcpp::stop ("stop_times must have trips and stops of engine");
+
+    const std::vector <std::vector <char> > dicts = {
+        network_dictionary (stops ["stop_id"]),
+        network_dictionary (stops ["stop_name"]),
+        network_dictionary (trips ["trip_id"]),
+        network_dictionary (trips ["route_id"]),
+        network_dictionary (trips ["route_short_name"]),
+        network_dictionary (trips ["trip_headsign"])};
+
+    Rcpp::DataFrame timetable = network_timetable (eng),
+        transfers = network_transfers (eng);
+
+    NetworkHeader header;
+    std::memcpy (header.magic, NETWORK_MAGIC, sizeof (header.magic));
+    header.version = NETWORK_VERSION;
+    header.byte_order = NETWORK_BYTE_ORDER;
+    header.nstations = eng.nstations;
+    header.ntrips = eng.ntrips;
+    header.nconnections = csa_in.departure_time.size ();
+    header.ntransfers = csa_in.transfer_map.dest.size ();
+    header.nstop_times = st_trip.size ();
+    header.fingerprint = csa::inputs_fingerprint (timetable, transfers);
+    header.stop_ids_size = dicts [0].size ();
+    header.stop_names_size = dicts [1].size ();
+    header.trip_ids_size = dicts [2].size ();
+    header.route_ids_size = dicts [3].size ();
+    header.route_names_size = dicts [4].size ();
+    header.headsigns_size = dicts [5].size ();
+
+    std::ofstream out (filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+        Rcpp::stop ("Unable to open network file " + filename);
+
+    write_network_array (out, &header, 1L);
+
+    const size_t n = csa_in.departure_time.size ();
+    write_network_array (out, csa_in.departure_station.data (), n);
+    write_network_array (out, csa_in.arrival_station.data (), n);
+    write_network_array (out, csa_in.trip_id.data (), n);
+    write_network_array (out, csa_in.departure_time.data (), n);
+    write_network_array (out, csa_in.arrival_time.data (), n);
+
+    write_transfer_graph (out, csa_in.transfer_map);
+    write_transfer_graph (out, eng.transfers_in);
+
+    const std::vector <uint32_t> st_trip32 (st_trip.begin (), st_trip.end ()),
+        st_stop32 (st_stop.begin (), st_stop.end ());
+    write_network_array (out, st_trip32.data (), st_trip32.size ());
+    write_network_array (out, st_stop32.data (), st_stop32.size ());
+    write_network_array (out, st_arrival.data (), st_arrival.size ());
+    write_network_array (out, st_departure.data (), st_departure.size ());
+
+    for (const auto &d: dicts)
+        write_network_array (out, d.data (), d.size ());
+
+    if (!out)
+        Rcpp::stop ("Unable to write network file " + filename); // # nocov
+}
+
+//' rcpp_network_read
+//'
+//' Read a binary network file written by `rcpp_network_write`. The file is
+//' memory-mapped, and the connections and transfers of the returned engine
+//' refer directly to the mapped file, so the file is only unmapped once the
+//' engine is garbage collected. Only the header and size of the file are
+//' checked, so reading the engine takes constant time.
+//'
+//' Returns a list of the "engine", along with tables of "stops", "trips", and
+//' "stop_times", in the forms passed to `rcpp_network_write`. These tables are
+//' copied from the file, as required for use in R.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_network_read (const std::string filename)
+{
+    std::shared_ptr <NetworkFile> file =
+        std::make_shared <NetworkFile> (filename);
+
+    NetworkHeader header;
+    if (file->size () < sizeof (header))
+        Rcpp::stop ("File is not a network file: " + filename);
+    std::memcpy (&header, file->data (), sizeof (header));
+
+    if (std::strncmp (header.magic, NETWORK_MAGIC, sizeof (header.magic)) != 0)
+        Rcpp::stop ("File is not a network file: " + filename);
+    if (header.version != NETWORK_VERSION)
+        Rcpp::stop ("Network file has version " +
+                std::to_string (header.version) + " but version " +
+                std::to_string (NETWORK_VERSION) + " is required");
+    if (header.byte_order != NETWORK_BYTE_ORDER)
+        Rcpp::stop ("Network file was written on a system of different byte order");
+    if (sizeof (size_t) != sizeof (uint64_t))
+        Rcpp::stop ("Network files can only be read on 64-bit systems"); // # nocov
+
+    const size_t nstations = header.nstations,
+          ntrips = header.ntrips,
+          ncons = header.nconnections,
+          ntransfers = header.ntransfers,
+          nstop_times = header.nstop_times;
+    const std::vector <size_t> dict_sizes = {
+        header.stop_ids_size, header.stop_names_size, header.trip_ids_size,
+        header.route_ids_size, header.route_names_size, header.headsigns_size};
+
+    size_t expected_size = network::array_bytes (1L, sizeof (header)) +
+        3L * network::array_bytes (ncons, sizeof (uint32_t)) +
+        2L * network::array_bytes (ncons, sizeof (int)) +
+        2L * network::array_bytes (nstations + 2L, sizeof (size_t)) +
+        2L * network::array_bytes (ntransfers, sizeof (size_t)) +
+        2L * network::array_bytes (ntransfers, sizeof (int)) +
+        2L * network::array_bytes (nstop_times, sizeof (uint32_t)) +
+        2L * network::array_bytes (nstop_times, sizeof (int));
+    for (auto d: dict_sizes)
+        expected_size += network::array_bytes (d, 1L);
+    if (file->size () != expected_size)
+        Rcpp::stop ("Network file has wrong size: " + filename);
+
+    CSA_Engine *engine = new CSA_Engine (nstations, ntrips);
+    engine->network_file = file;
+    engine->fingerprint = header.fingerprint;
+    CSA_Inputs &csa_in = engine->csa_in;
+
+    size_t pos = network::array_bytes (1L, sizeof (header));
+    view_network_array (csa_in.departure_station, *file, pos, ncons);
+    view_network_array (csa_in.arrival_station, *file, pos, ncons);
+    view_network_array (csa_in.trip_id, *file, pos, ncons);
+    view_network_array (csa_in.departure_time, *file, pos, ncons);
+    view_network_array (csa_in.arrival_time, *file, pos, ncons);
+
+    for (TransferGraph *tr: {&csa_in.transfer_map, &engine->transfers_in})
+    {
+        view_network_array (tr->offsets, *file, pos, nstations + 2L);
+        view_network_array (tr->dest, *file, pos, ntransfers);
+        view_network_array (tr->duration, *file, pos, ntransfers);
+    }
+
+    Rcpp::XPtr <CSA_Engine> ptr (engine, true);
+
+    // Arrays are read in order, each advancing 'pos':
+    const std::vector <int> st_trip =
+        read_network_array <uint32_t> (*file, pos, nstop_times);
+    const std::vector <int> st_stop =
+        read_network_array <uint32_t> (*file, pos, nstop_times);
+    const std::vector <int> st_arrival =
+        read_network_array <int> (*file, pos, nstop_times);
+    const std::vector <int> st_departure =
+        read_network_array <int> (*file, pos, nstop_times);
+    Rcpp::DataFrame stop_times = Rcpp::DataFrame::create (
+            Rcpp::Named ("trip") = st_trip,
+            Rcpp::Named ("stop") = st_stop,
+            Rcpp::Named ("arrival_time") = st_arrival,
+            Rcpp::Named ("departure_time") = st_departure,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    std::vector <Rcpp::CharacterVector> dicts;
+    for (size_t i = 0; i < dict_sizes.size (); i++)
+    {
+        dicts.push_back (network::read_dictionary (file->data () + pos,
+                    dict_sizes [i], i < 2 ? nstations : ntrips));
+        pos += network::array_bytes (dict_sizes [i], 1L);
+    }
+
+    Rcpp::DataFrame stops = Rcpp::DataFrame::create (
+            Rcpp::Named ("stop_id") = dicts [0],
+            Rcpp::Named ("stop_name") = dicts [1],
+            Rcpp::_["stringsAsFactors"] = false);
+    Rcpp::DataFrame trips = Rcpp::DataFrame::create (
+            Rcpp::Named ("trip_id") = dicts [2],
+            Rcpp::Named ("route_id") = dicts [3],
+            Rcpp::Named ("route_short_name") = dicts [4],
+            Rcpp::Named ("trip_headsign") = dicts [5],
+            Rcpp::_["stringsAsFactors"] = false);
+
+    Rcpp::List res = Rcpp::List::create (
+            Rcpp::Named ("engine") = ptr,
+            Rcpp::Named ("stops") = stops,
+            Rcpp::Named ("trips") = trips,
+            Rcpp::Named ("stop_times") = stop_times);
+
+    return res;
+}
+
+//' rcpp_network_tables
+//'
+//' Tables of an engine read from a network file, which are only constructed
+//' when needed, as they are copies of the mapped arrays. The transfers, which
+//' are needed for routing, are always returned, and the timetable only if
+//' `timetable` is `TRUE`. The transfer graphs, and the connections of any
+//' timetable, are checked first, so that corrupt files are rejected. The
+//' checksum of the returned tables is then compared with that recorded in the
+//' file when each engine is first used.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_network_tables (SEXP engine, const bool timetable)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const CSA_Engine &eng = *ptr;
+    const size_t ntransfers = eng.csa_in.transfer_map.dest.size ();
+
+    network::check_transfer_graph (eng.csa_in.transfer_map, eng.nstations,
+            ntransfers);
+    network::check_transfer_graph (eng.transfers_in, eng.nstations,
+            ntransfers);
+    if (timetable)
+        csa::check_csa_inputs (eng.csa_in, eng.nstations, eng.ntrips);
+
+    Rcpp::DataFrame transfers = network_transfers (eng);
+    if (!timetable)
+        return Rcpp::List::create (Rcpp::Named ("transfers") = transfers);
+
+    return Rcpp::List::create (
+            Rcpp::Named ("timetable") = network_timetable (eng),
+            Rcpp::Named ("transfers") = transfers);
+}
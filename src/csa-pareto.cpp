@@ -0,0 +1,259 @@
+#include "csa.h"
+
+//' rcpp_csa_pareto
+//'
+//' Multi-criteria Connection Scan using a compiled engine, returning all
+//' journeys between start and end stations which are Pareto-optimal in terms of
+//' arrival time and number of transfers, from a single scan of the timetable.
+//' Labels are kept for each station and each number of trips used, so that
+//' journeys with fewer transfers are retained even when they arrive later.
+//' Transfers are counted as changes between trips, so are one less than the
+//' number of trips in a journey, and are limited to `max_transfers`.
+//'
+//' Journeys are returned in a single DataFrame with "journey" and
+//' "ntransfers" columns, ordered by increasing numbers of transfers (and so
+//' decreasing arrival times). The rows of each journey are in the same form
+//' and order as those returned from `rcpp_csa`, starting at the end station.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_csa_pareto (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+
+    check_engine_stations (start_stations, ptr->nstations, "Start");
+    check_engine_stations (end_stations, ptr->nstations, "End");
+
+    const uint64_t *trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    // Maximal number of trips, avoiding overflow for max_transfers = INT_MAX:
+    const size_t max_trips = (max_transfers < 0) ? 1L :
+        static_cast <size_t> (max_transfers) + 1L;
+
+    Pareto_Labels labels (ptr->nstations + 1, ptr->ntrips + 1);
+
+    pareto::scan (ptr->csa_in, start_stations, end_stations, start_time,
+            max_trips, trip_active, labels);
+
+    std::vector <int> journey, ntransfers, time;
+    std::vector <size_t> stop_number, trip_number;
+
+    pareto::extract_journeys (ptr->csa_in, labels,
+            journey, ntransfers, stop_number, time, trip_number);
+
+    Rcpp::DataFrame res = Rcpp::DataFrame::create (
+            Rcpp::Named ("journey") = journey,
+            Rcpp::Named ("ntransfers") = ntransfers,
+            Rcpp::Named ("stop_number") = stop_number,
+            Rcpp::Named ("time") = time,
+            Rcpp::Named ("trip_number") = trip_number,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    return res;
+}
+
+// Level [0] holds stations reachable without using any trip, which are the
+// start stations and those with transfers from them.
+void pareto::initialise (
+        const CSA_Inputs &csa_in,
+        const std::vector <size_t> &start_stations,
+        const int &start_time,
+        Pareto_Labels &labels)
+{
+
+    labels.add_level ();
+    for (auto s: start_stations)
+    {
+        labels.arrival [0][s] = start_time;
+        for (size_t k = csa_in.transfer_map.begin (s);
+                k < csa_in.transfer_map.end (s); k++)
+            labels.arrival [0][csa_in.transfer_map.dest [k]] = start_time;
+    }
+}
+
+// Earliest arrival at station stn using no more than ntrips trips.
+int pareto::best_arrival (
+        const Pareto_Labels &labels,
+        const size_t &stn,
+        const size_t &ntrips)
+{
+
+    int best = INFINITE_INT;
+    const size_t nlevels = std::min (ntrips + 1, labels.arrival.size ());
+    for (size_t k = 0; k < nlevels; k++)
+        best = std::min (best, labels.arrival [k][stn]);
+
+    return best;
+}
+
+// Set a label if it is not dominated by any label at the same station with
+// the same or fewer trips, nor by any journey to an end station. Returns true
+// if the label was set.
+bool pareto::set_label (
+        Pareto_Labels &labels,
+        const size_t &ntrips,
+        const size_t &stn,
+        const int &arrival_time)
+{
+
+    if (arrival_time >= pareto::best_arrival (labels, stn, ntrips))
+        return false;
+    if (arrival_time >= labels.best_end_arrival (ntrips))
+        return false;
+
+    labels.arrival [ntrips][stn] = arrival_time;
+    if (labels.is_end [stn] && arrival_time < labels.end_arrival [ntrips])
+    {
+        labels.end_arrival [ntrips] = arrival_time;
+        labels.end_station [ntrips] = stn;
+    }
+
+    return true;
+}
+
+void pareto::scan (
+        const CSA_Inputs &csa_in,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        const int &start_time,
+        const size_t &max_trips,
+        const uint64_t *trip_active,
+        Pareto_Labels &labels)
+{
+
+    for (auto e: end_stations)
+        labels.is_end [e] = true;
+
+    pareto::initialise (csa_in, start_stations, start_time, labels);
+
+    const size_t first_con = csa::first_connection (csa_in.departure_time,
+            start_time);
+    const size_t ncons = csa_in.departure_time.size ();
+
+    for (size_t i = first_con; i < ncons; i++)
+    {
+        // A direct journey can not be improved upon by anything departing
+        // after it arrives:
+        if (labels.end_arrival.size () > 1 &&
+                csa_in.departure_time [i] >= labels.end_arrival [1])
+            break;
+
+        const size_t dep_stn = csa_in.departure_station [i];
+        const size_t arr_stn = csa_in.arrival_station [i];
+        const size_t trip = csa_in.trip_id [i];
+
+        if (!trip_is_active (trip_active, trip))
+            continue;
+
+        // Boarding this trip afresh here may need fewer trips than staying
+        // on it from a previous boarding:
+        for (size_t k = 0; k < labels.arrival.size () &&
+                k + 1 < labels.trip_ntrips [trip]; k++)
+        {
+            if (labels.arrival [k][dep_stn] <= csa_in.departure_time [i])
+            {
+                labels.trip_ntrips [trip] = k + 1;
+                labels.trip_board [trip] = i;
+                break;
+            }
+        }
+
+        const size_t ntrips = labels.trip_ntrips [trip];
+        const size_t board = labels.trip_board [trip];
+
+        if (board == INFINITE_INT || ntrips > max_trips)
+            continue;
+
+        if (ntrips == labels.arrival.size ())
+            labels.add_level ();
+
+        if (!pareto::set_label (labels, ntrips, arr_stn,
+                    csa_in.arrival_time [i]))
+            continue;
+
+        labels.board [ntrips][arr_stn] = board;
+        labels.alight [ntrips][arr_stn] = i;
+        labels.walk_from [ntrips][arr_stn] = INFINITE_INT;
+
+        for (size_t k = csa_in.transfer_map.begin (arr_stn);
+                k < csa_in.transfer_map.end (arr_stn); k++)
+        {
+            const size_t dest = csa_in.transfer_map.dest [k];
+            if (pareto::set_label (labels, ntrips, dest,
+                        csa_in.arrival_time [i] + csa_in.transfer_map.duration [k]))
+            {
+                labels.walk_from [ntrips][dest] = arr_stn;
+            }
+        }
+    }
+}
+
+// Trace journeys back from each non-dominated end station label, and append
+// them to the output vectors. Each leg includes all stops of the trip between
+// boarding and alighting.
+void pareto::extract_journeys (
+        const CSA_Inputs &csa_in,
+        const Pareto_Labels &labels,
+        std::vector <int> &journey,
+        std::vector <int> &ntransfers,
+        std::vector <size_t> &stop_number,
+        std::vector <int> &time,
+        std::vector <size_t> &trip_number)
+{
+
+    int best_arrival = INFINITE_INT;
+    int count = 0;
+
+    for (size_t ntrips = 1; ntrips < labels.end_arrival.size (); ntrips++)
+    {
+        if (labels.end_arrival [ntrips] >= best_arrival)
+            continue;
+        best_arrival = labels.end_arrival [ntrips];
+        count++;
+
+        size_t stn = labels.end_station [ntrips];
+        size_t k = ntrips;
+
+        if (labels.walk_from [k][stn] < INFINITE_INT)
+        {
+            // Terminal transfer, which has no trip:
+            stop_number.push_back (stn);
+            time.push_back (labels.arrival [k][stn]);
+            trip_number.push_back (INFINITE_INT);
+        }
+
+        while (k > 0)
+        {
+            if (labels.walk_from [k][stn] < INFINITE_INT)
+                stn = labels.walk_from [k][stn];
+
+            const size_t alight = labels.alight [k][stn];
+            const size_t board = labels.board [k][stn];
+            const size_t trip = csa_in.trip_id [alight];
+
+            stop_number.push_back (csa_in.arrival_station [alight]);
+            time.push_back (csa_in.arrival_time [alight]);
+            trip_number.push_back (trip);
+            for (size_t i = alight + 1; i-- > board; )
+            {
+                if (csa_in.trip_id [i] != trip)
+                    continue;
+                stop_number.push_back (csa_in.departure_station [i]);
+                time.push_back (csa_in.departure_time [i]);
+                trip_number.push_back (trip);
+            }
+
+            stn = csa_in.departure_station [board];
+            k--;
+        }
+
+        journey.resize (stop_number.size (), count);
+        ntransfers.resize (stop_number.size (), static_cast <int> (ntrips) - 1);
+    }
+}
@@ -2,23 +2,25 @@
 
 //' rcpp_make_timetable
 //'
-//' Make timetable from GTFS stop_times. Both stop_ids and trip_ids are vectors
-//' of unique values which are converted to unordered_maps on to 1-indexed
-//' integer values.
+//' Make timetable from GTFS stop_times. The `stop_id` and `trip_id` columns of
+//' `stop_times` must be integer codes of 1-indexed positions within the vectors
+//' of unique stop and trip IDs, as constructed once in R. Rows with `NA`
+//' values of `trip_id` are trips which are not part of the timetable, and are
+//' ignored.
 //'
 //' @noRd
 // [[Rcpp::export]]
-Rcpp::DataFrame rcpp_make_timetable (Rcpp::DataFrame stop_times,
-        std::vector <std::string> stop_ids, std::vector <std::string> trip_ids)
+Rcpp::DataFrame rcpp_make_timetable (Rcpp::DataFrame stop_times)
 {
     Timetable_Inputs tt_in;
     timetable::timetable_in_from_df (stop_times, tt_in);
 
-    size_t n = timetable::count_connections (tt_in);
+    std::vector <size_t> block_start, block_offset;
+    const size_t n = timetable::trip_blocks (tt_in, block_start, block_offset);
 
     Timetable_Outputs tt_out;
     timetable::initialise_tt_outputs (tt_out, n);
-    timetable::make_timetable (tt_in, tt_out, stop_ids, trip_ids);
+    timetable::make_timetable (tt_in, tt_out, block_start, block_offset);
 
     Rcpp::DataFrame timetable = Rcpp::DataFrame::create (
             Rcpp::Named ("departure_station") = tt_out.departure_station,
@@ -34,27 +36,43 @@ Rcpp::DataFrame rcpp_make_timetable (Rcpp::DataFrame stop_times,
 void timetable::timetable_in_from_df (Rcpp::DataFrame &stop_times,
         Timetable_Inputs &tt_in)
 {
-    tt_in.stop_id = Rcpp::as <std::vector <std::string> > (stop_times ["stop_id"]);
-    tt_in.trip_id = Rcpp::as <std::vector <std::string> > (stop_times ["trip_id"]);
+    tt_in.stop_id = Rcpp::as <std::vector <int> > (stop_times ["stop_id"]);
+    tt_in.trip_id = Rcpp::as <std::vector <int> > (stop_times ["trip_id"]);
     tt_in.arrival_time = Rcpp::as <std::vector <int> > (
             stop_times ["arrival_time"]);
     tt_in.departure_time = Rcpp::as <std::vector <int> > (
             stop_times ["departure_time"]);
 }
 
-size_t timetable::count_connections (const Timetable_Inputs &tt_in)
+// Split stop_times into blocks of consecutive rows of the same trip, each of
+// which gives one connection less than its number of rows. Returns the total
+// number of connections, with `block_offset` holding the index of the first
+// connection of each block. `block_start` has one more entry than the number
+// of blocks, the last being the total number of rows.
+size_t timetable::trip_blocks (const Timetable_Inputs &tt_in,
+        std::vector <size_t> &block_start,
+        std::vector <size_t> &block_offset)
 {
+    const size_t nrows = tt_in.trip_id.size ();
+
+    block_start.clear ();
+    block_offset.clear ();
+
     size_t n_connections = 0;
-    std::string trip_id_i = tt_in.trip_id [0];
-    for (size_t i = 1; i < tt_in.trip_id.size (); i++)
+    for (size_t i = 0; i < nrows; i++)
     {
-        if (tt_in.trip_id [i] == trip_id_i)
-            n_connections++;
-        else
+        if (i > 0 && tt_in.trip_id [i] == tt_in.trip_id [i - 1])
+        {
+            if (tt_in.trip_id [i] != NA_INTEGER)
+                n_connections++;
+        } else
         {
-            trip_id_i = tt_in.trip_id [i];
+            block_start.push_back (i);
+            block_offset.push_back (n_connections);
         }
     }
+    block_start.push_back (nrows);
+
     return n_connections;
 }
     
@@ -67,44 +85,31 @@ void timetable::initialise_tt_outputs (Timetable_Outputs &tt_out, size_t n)
     tt_out.trip_id.resize (n);
 }
 
-void timetable::make_trip_stop_map (const std::vector <std::string> &input,
-        std::unordered_map <std::string, int> &output_map)
-{
-    int count = 1; // 1-indexed
-    for (auto i: input)
-        output_map.emplace (i, count++);
-}
-
+// Each block of trips writes to its own range of outputs, so blocks can be
+// processed in parallel.
 void timetable::make_timetable (const Timetable_Inputs &tt_in,
         Timetable_Outputs &tt_out,
-        const std::vector <std::string> &stop_ids,
-        const std::vector <std::string> &trip_ids)
+        const std::vector <size_t> &block_start,
+        const std::vector <size_t> &block_offset)
 {
-    std::unordered_map <std::string, int> trip_id_map;
-    make_trip_stop_map (trip_ids, trip_id_map);
-
-    std::unordered_map <std::string, int> stop_id_map;
-    make_trip_stop_map (stop_ids, stop_id_map);
+    const size_t nblocks = block_offset.size ();
 
-    size_t n_connections = 0;
-    std::string trip_id_i = tt_in.trip_id [0];
-    int dest_stop = stop_id_map.at (tt_in.stop_id [0]);
-    for (size_t i = 1; i < tt_in.trip_id.size (); i++)
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < nblocks; b++)
     {
-        if (tt_in.trip_id [i] == trip_id_i)
-        {
-            int arrival_stop = stop_id_map.at (tt_in.stop_id [i]);
-            tt_out.departure_station [n_connections] = dest_stop;
-            tt_out.arrival_station [n_connections] = arrival_stop;
-            tt_out.departure_time [n_connections] = tt_in.departure_time [i - 1];
-            tt_out.arrival_time [n_connections] = tt_in.arrival_time [i];
-            tt_out.trip_id [n_connections] = trip_id_map.at (trip_id_i);
-            dest_stop = arrival_stop;
-            n_connections++;
-        } else
+        const int trip = tt_in.trip_id [block_start [b]];
+        if (trip == NA_INTEGER)
+            continue;
+
+        size_t n = block_offset [b];
+        for (size_t i = block_start [b] + 1; i < block_start [b + 1]; i++)
         {
-            dest_stop = stop_id_map.at (tt_in.stop_id [i]);
-            trip_id_i = tt_in.trip_id [i];
+            tt_out.departure_station [n] = tt_in.stop_id [i - 1];
+            tt_out.arrival_station [n] = tt_in.stop_id [i];
+            tt_out.departure_time [n] = tt_in.departure_time [i - 1];
+            tt_out.arrival_time [n] = tt_in.arrival_time [i];
+            tt_out.trip_id [n] = trip;
+            n++;
         }
     }
 }
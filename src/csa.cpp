@@ -31,22 +31,66 @@ Rcpp::DataFrame rcpp_csa (Rcpp::DataFrame timetable,
     csa::fill_csa_pars (csa_pars, max_transfers, start_time,
             static_cast <size_t> (timetable.nrow ()), ntrips, nstations);
 
-    std::unordered_set <size_t> start_stations_set, end_stations_set;
-    csa::make_station_sets (start_stations, end_stations,
-            start_stations_set, end_stations_set);
-
     CSA_Inputs csa_in;
-    csa::make_transfer_map (csa_in.transfer_map, transfers);
+    csa::make_transfer_map (csa_in.transfer_map, transfers, nstations);
+    csa::csa_in_from_df (timetable, csa_in);
+    csa::check_csa_inputs (csa_in, nstations, ntrips);
 
     // The csa_out vectors use nstations + 1 because it's 1-indexed throughout,
     // and the first element is ignored.
     const size_t n = csa_pars.nstations + 1;
-    CSA_Outputs csa_out (n);
+    CSA_Outputs csa_out (n, ntrips + 1);
 
-    csa::get_earliest_connection (start_stations, csa_pars.start_time,
-            csa_in.transfer_map, csa_out.earliest_connection);
+    return csa::route_query (csa_pars, csa_in, csa_out,
+            start_stations, end_stations);
+}
 
-    csa::csa_in_from_df (timetable, csa_in);
+// Single routing query on already-converted inputs, with csa_out presumed to
+// be in initial state.
+Rcpp::DataFrame csa::route_query (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations)
+{
+
+    std::vector <size_t> end_station_out, trip_out;
+    std::vector <int> time_out;
+
+    csa::route_query_vectors (csa_pars, csa_in, csa_out,
+            start_stations, end_stations,
+            end_station_out, trip_out, time_out);
+
+    Rcpp::DataFrame res = Rcpp::DataFrame::create (
+            Rcpp::Named ("stop_number") = end_station_out,
+            Rcpp::Named ("time") = time_out,
+            Rcpp::Named ("trip_number") = trip_out,
+            Rcpp::_["stringsAsFactors"] = false);
+
+    return res;
+}
+
+// The core of route_query, which fills the three output vectors. These are
+// empty if no route is found. This does not touch the R API, and so may be
+// called from multiple threads, each with their own csa_out.
+void csa::route_query_vectors (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        std::vector <size_t> &end_station_out,
+        std::vector <size_t> &trip_out,
+        std::vector <int> &time_out)
+{
+
+    std::unordered_set <size_t> start_stations_set, end_stations_set;
+    csa::make_station_sets (start_stations, end_stations,
+            start_stations_set, end_stations_set);
+
+    csa::get_earliest_connection (start_stations, csa_pars.start_time,
+            csa_in.transfer_map, csa_out);
 
     CSA_Return csa_ret = csa::main_csa_loop (csa_pars, start_stations_set,
             end_stations_set, csa_in, csa_out);
@@ -54,20 +98,51 @@ Rcpp::DataFrame rcpp_csa (Rcpp::DataFrame timetable,
     size_t route_len = csa::get_route_length (csa_out, csa_pars,
             csa_ret.end_station);
 
-    std::vector <size_t> end_station_out (route_len),
-        trip_out (route_len, INFINITE_INT);
-    std::vector <int> time_out (route_len);
+    end_station_out.resize (route_len);
+    trip_out.assign (route_len, INFINITE_INT);
+    time_out.resize (route_len);
 
     csa::extract_final_trip (csa_out, csa_ret, end_station_out,
             trip_out, time_out);
+}
 
-    Rcpp::DataFrame res = Rcpp::DataFrame::create (
-            Rcpp::Named ("stop_number") = end_station_out,
-            Rcpp::Named ("time") = time_out,
-            Rcpp::Named ("trip_number") = trip_out,
-            Rcpp::_["stringsAsFactors"] = false);
+// Reverse equivalent of route_query_vectors, for journeys from
+// start_stations to end_stations arriving by arrival_time. The scan starts
+// from end_stations, and so outputs are in the same form as those from
+// route_query_vectors applied to a reversed timetable, with times in seconds
+// prior to arrival_time.
+void csa::route_query_vectors_reverse (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        const int &arrival_time,
+        std::vector <size_t> &end_station_out,
+        std::vector <size_t> &trip_out,
+        std::vector <int> &time_out)
+{
 
-    return res;
+    std::unordered_set <size_t> start_stations_set, end_stations_set;
+    csa::make_station_sets (end_stations, start_stations,
+            start_stations_set, end_stations_set);
+
+    csa::get_earliest_connection (end_stations, 0L,
+            csa_in.transfer_map, csa_out);
+
+    CSA_Return csa_ret = csa::main_csa_loop_reverse (csa_pars,
+            start_stations_set, end_stations_set, csa_in, arrival_time,
+            csa_out);
+
+    size_t route_len = csa::get_route_length (csa_out, csa_pars,
+            csa_ret.end_station);
+
+    end_station_out.resize (route_len);
+    trip_out.assign (route_len, INFINITE_INT);
+    time_out.resize (route_len);
+
+    csa::extract_final_trip (csa_out, csa_ret, end_station_out,
+            trip_out, time_out);
 }
 
 void csa::fill_csa_pars (
@@ -86,6 +161,17 @@ void csa::fill_csa_pars (
     csa_pars.nstations = nstations;
 }
 
+// Index of first connection departing at or after start_time, from a binary
+// search of the sorted departure times.
+size_t csa::first_connection (
+        const NetworkArray <int> &departure_time,
+        const int &start_time)
+{
+
+    return static_cast <size_t> (std::lower_bound (departure_time.begin (),
+                departure_time.end (), start_time) - departure_time.begin ());
+}
+
 // make start and end stations into std::unordered_sets to allow constant-time
 // lookup.
 void csa::make_station_sets (
@@ -106,11 +192,11 @@ void csa::csa_in_from_df (
         CSA_Inputs &csa_in)
 {
 
-    csa_in.departure_station = Rcpp::as <std::vector <size_t> > (
+    csa_in.departure_station = Rcpp::as <std::vector <uint32_t> > (
             timetable ["departure_station"]);
-    csa_in.arrival_station = Rcpp::as <std::vector <size_t> > (
+    csa_in.arrival_station = Rcpp::as <std::vector <uint32_t> > (
             timetable ["arrival_station"]);
-    csa_in.trip_id = Rcpp::as <std::vector <size_t> > (
+    csa_in.trip_id = Rcpp::as <std::vector <uint32_t> > (
             timetable ["trip_id"]);
     csa_in.departure_time = Rcpp::as <std::vector <int> > (
             timetable ["departure_time"]);
@@ -118,54 +204,213 @@ void csa::csa_in_from_df (
             timetable ["arrival_time"]);
 }
 
-// convert transfers into a map from start to (end, transfer_time).
-void csa::make_transfer_map (
-        TransferMapType &transfer_map,
+// Station and trip numbers are used directly as array indices, so are checked
+// once here rather than within the main scan. Scans also start from a binary
+// search on departure times, so these must be sorted.
+void csa::check_csa_inputs (
+        const CSA_Inputs &csa_in,
+        const size_t nstations,
+        const size_t ntrips)
+{
+
+    for (size_t i = 0; i < csa_in.departure_station.size (); i++)
+    {
+        if (i > 0 && csa_in.departure_time [i] < csa_in.departure_time [i - 1]) {
+            Rcpp::stop ("Timetable must be sorted by departure_time.");
+        }
+        if (csa_in.departure_station [i] > nstations) {
+            Rcpp::stop ("Departure station in wrong range.");
+        }
+        if (csa_in.arrival_station [i] > nstations) {
+            Rcpp::stop ("Arrival station in wrong range.");
+        }
+        if (csa_in.trip_id [i] > ntrips) {
+            Rcpp::stop ("Trip id in wrong range.");
+        }
+    }
+}
+
+// The columns of the timetable and transfers which are compiled into engines.
+Rcpp::List csa::input_columns (
+        Rcpp::DataFrame &timetable,
         Rcpp::DataFrame &transfers)
 {
+    Rcpp::List columns (8);
+    size_t i = 0;
+    for (auto col: {"departure_station", "arrival_station", "trip_id",
+            "departure_time", "arrival_time"})
+    {
+        SEXP x = timetable [col];
+        columns [i++] = x;
+    }
+    for (auto col: {"from_stop_id", "to_stop_id", "min_transfer_time"})
+    {
+        SEXP x = transfers [col];
+        columns [i++] = x;
+    }
+
+    return columns;
+}
+
+// Checksum of all input columns, converted in the same way as in
+// `csa_in_from_df` and `make_transfer_map`, but read in place. Engines are only
+// re-used for tables with the same checksum, so any edits to those tables,
+// including re-ordering rows, cause engines to be re-compiled.
+uint64_t csa::inputs_fingerprint (const Rcpp::List &columns)
+{
+    uint64_t h = 14695981039346656037ULL;
+    auto add_value = [&h] (const int xi) {
+        h ^= static_cast <uint32_t> (xi);
+        h *= 1099511628211ULL;
+        h ^= h >> 29;
+    };
+
+    for (size_t i = 0; i < columns.size (); i++)
+    {
+        SEXP x = columns [i];
+        const R_xlen_t n = Rf_xlength (x);
+        h = (h ^ static_cast <uint64_t> (n)) * 1099511628211ULL;
+        if (TYPEOF (x) == INTSXP || TYPEOF (x) == LGLSXP)
+        {
+            const int *xp = INTEGER (x);
+            for (R_xlen_t j = 0; j < n; j++)
+                add_value (xp [j]);
+        } else if (TYPEOF (x) == REALSXP)
+        {
+            const double *xp = REAL (x);
+            for (R_xlen_t j = 0; j < n; j++)
+                add_value (std::isnan (xp [j]) ?
+                        NA_INTEGER : static_cast <int> (xp [j]));
+        } else
+        {
+            for (auto xi: Rcpp::as <std::vector <int> > (x))
+                add_value (xi);
+        }
+    }
+
+    return h;
+}
+
+uint64_t csa::inputs_fingerprint (
+        Rcpp::DataFrame &timetable,
+        Rcpp::DataFrame &transfers)
+{
+    return csa::inputs_fingerprint (csa::input_columns (timetable, transfers));
+}
+
+// Whether two sets of input columns are the same R objects, in which case the
+// checksum of one holds for the other without having to be re-calculated.
+bool csa::same_columns (const Rcpp::List &a, const Rcpp::List &b)
+{
+    if (a.size () != b.size ())
+        return false;
+    for (size_t i = 0; i < a.size (); i++)
+    {
+        SEXP ai = a [i], bi = b [i];
+        if (ai != bi)
+            return false;
+    }
+
+    return true;
+}
+
+// convert transfers into a graph from start to (end, transfer_time).
+void csa::make_transfer_map (
+        TransferGraph &transfer_map,
+        Rcpp::DataFrame &transfers,
+        const size_t nstations)
+{
 
-    transfer_map.clear ();
     std::vector <size_t> trans_from = transfers ["from_stop_id"],
         trans_to = transfers ["to_stop_id"];
     std::vector <int> trans_time = transfers ["min_transfer_time"];
-    for (size_t i = 0; i < static_cast <size_t> (transfers.nrow ()); i++)
-        if (trans_from [i] != trans_to [i])
+
+    csa::make_transfer_graph (transfer_map, trans_from, trans_to, trans_time,
+            nstations);
+}
+
+// Construct the CSR transfer graph for 1-based stations up to nstations.
+// Transfers from a station retain their order in the input table, and only
+// the first of any duplicated (from, to) pairs is kept. Self-transfers, and
+// transfers with stations out of range, are ignored.
+void csa::make_transfer_graph (
+        TransferGraph &transfer_map,
+        const std::vector <size_t> &trans_from,
+        const std::vector <size_t> &trans_to,
+        const std::vector <int> &trans_time,
+        const size_t nstations)
+{
+
+    const size_t n = nstations + 1;
+    const size_t ntransfers = trans_from.size ();
+
+    std::vector <size_t> offsets (n + 1, 0L);
+
+    // count outgoing transfers of each station:
+    std::vector <bool> keep (ntransfers, false);
+    std::vector <size_t> last_from (n, INFINITE_INT);
+    std::vector <size_t> order (ntransfers);
+    for (size_t i = 0; i < ntransfers; i++)
+        if (trans_from [i] != trans_to [i] && trans_from [i] < n &&
+                trans_to [i] < n)
         {
-            std::unordered_map <size_t, int> transfer_pair; // station, time
-            if (transfer_map.find (trans_from [i]) ==
-                    transfer_map.end ())
-            {
-                transfer_pair.clear ();
-                transfer_pair.emplace (trans_to [i], trans_time [i]);
-                transfer_map.emplace (trans_from [i], transfer_pair);
-            } else
-            {
-                transfer_pair = transfer_map.at (trans_from [i]);
-                transfer_pair.emplace (trans_to [i], trans_time [i]);
-                transfer_map [trans_from [i] ] = transfer_pair;
-            }
+            keep [i] = true;
+            offsets [trans_from [i] + 1]++;
         }
+    // Stable ordering of kept transfers by station, so that duplicates are
+    // adjacent to each other within each station:
+    for (size_t s = 1; s <= n; s++)
+        offsets [s] += offsets [s - 1];
+    std::vector <size_t> pos (offsets.begin (), offsets.end () - 1);
+    for (size_t i = 0; i < ntransfers; i++)
+        if (keep [i])
+            order [pos [trans_from [i]]++] = i;
+
+    std::vector <size_t> dest;
+    std::vector <int> duration;
+    dest.reserve (offsets [n]);
+    duration.reserve (offsets [n]);
+
+    size_t count = 0;
+    for (size_t s = 0; s < n; s++)
+    {
+        const size_t start = offsets [s], end = offsets [s + 1];
+        offsets [s] = count;
+        for (size_t k = start; k < end; k++)
+        {
+            const size_t i = order [k];
+            if (last_from [trans_to [i]] == s)
+                continue; // duplicate
+            last_from [trans_to [i]] = s;
+            dest.push_back (trans_to [i]);
+            duration.push_back (trans_time [i]);
+            count++;
+        }
+    }
+    offsets [n] = count;
+
+    transfer_map.offsets = std::move (offsets);
+    transfer_map.dest = std::move (dest);
+    transfer_map.duration = std::move (duration);
 }
 
 void csa::get_earliest_connection (
         const std::vector <size_t> &start_stations,
         const int &start_time,
-        const TransferMapType &transfer_map,
-        std::vector <int> &earliest_connection)
+        const TransferGraph &transfer_map,
+        CSA_Outputs &csa_out)
 {
 
     for (size_t i = 0; i < start_stations.size (); i++)
     {
-        earliest_connection [start_stations [i]] = start_time;
-        if (transfer_map.find (start_stations [i]) !=
-                transfer_map.end ())
+        csa_out.touch (start_stations [i]);
+        csa_out.earliest_connection [start_stations [i]] = start_time;
+        // Don't penalise these first footpaths:
+        for (size_t k = transfer_map.begin (start_stations [i]);
+                k < transfer_map.end (start_stations [i]); k++)
         {
-            std::unordered_map <size_t, int> transfer_pair =
-                transfer_map.at (start_stations [i]);
-            // Don't penalise these first footpaths:
-            for (auto t: transfer_pair)
-                earliest_connection [t.first] = start_time;
-                //earliest_connection [t.first] = start_time + t.second;
+            csa_out.touch (transfer_map.dest [k]);
+            csa_out.earliest_connection [transfer_map.dest [k]] = start_time;
         }
     }
 }
@@ -182,35 +427,29 @@ CSA_Return csa::main_csa_loop (
     csa_ret.earliest_time = INFINITE_INT;
     csa_ret.end_station = INFINITE_INT;
 
-    std::vector <bool> is_connected (csa_pars.ntrips + 1L, false);
-
-    // trip connections:
-    for (size_t i = 0; i < csa_pars.timetable_size; i++)
+    // trip connections, starting with the first departing at or after the
+    // start time:
+    const size_t first_con = csa::first_connection (csa_in.departure_time,
+            csa_pars.start_time);
+    for (size_t i = first_con; i < csa_pars.timetable_size; i++)
     {
-        if (csa_in.departure_time [i] < csa_pars.start_time)
-            continue; // # nocov - these lines already removed in R fn.
+        if (!trip_is_active (csa_pars.trip_active, csa_in.trip_id [i]))
+            continue;
 
         // add all departures from start_stations_set:
         if (start_stations_set.find (csa_in.departure_station [i]) !=
                 start_stations_set.end () &&
                 csa_in.arrival_time [i] <= csa_out.earliest_connection [csa_in.arrival_station [i] ])
         {
-            is_connected [csa_in.trip_id [i] ] = true;
+            csa_out.connect_trip (csa_in.trip_id [i]);
             csa::fill_one_csa_out (csa_out, csa_in,
                     csa_in.arrival_station [i], i);
         }
 
-        if (csa_in.departure_station [i] < 0 || csa_in.departure_station [i] >= csa_out.earliest_connection.size ()) {
-            Rcpp::stop ("Departure station in wrong range.");
-        }
-        if (csa_in.trip_id [i] < 0 || csa_in.trip_id [i] >= is_connected.size ()) {
-            Rcpp::stop ("Trip id in wrong range.");
-        }
-
         // main connection scan:
         if (((csa_out.earliest_connection [csa_in.departure_station [i] ] <= csa_in.departure_time [i]) &&
                     csa_out.n_transfers [csa_in.departure_station [i] ] <= csa_pars.max_transfers) ||
-                is_connected [csa_in.trip_id [i]])
+                csa_out.is_connected [csa_in.trip_id [i]])
         {
             const bool time_earlier = csa_in.arrival_time [i] < csa_out.earliest_connection [csa_in.arrival_station [i] ];
             const bool time_equal = csa_in.arrival_time [i] == csa_out.earliest_connection [csa_in.arrival_station [i] ];
@@ -228,15 +467,16 @@ CSA_Return csa::main_csa_loop (
                 csa::fill_one_csa_out (csa_out, csa_in,
                         csa_in.arrival_station [i], i);
 
-                if (!is_connected [csa_in.trip_id [i]]) {
+                if (!csa_out.is_connected [csa_in.trip_id [i]]) {
                     DEBUGMSG_CSA("   main loop: updating arrival transfers " <<
                         csa_in.departure_station [i] << " -> " <<
                         csa_in.arrival_station [i] << " from " <<
                         csa_out.n_transfers [csa_in.arrival_station [i] ] << " to " <<
                         csa_out.n_transfers [csa_in.departure_station [i] ] <<
-                        "; is_connected = " << is_connected [csa_in.trip_id [i]]
+                        "; is_connected = " << csa_out.is_connected [csa_in.trip_id [i]]
                         , csa_in.arrival_station [i]);
 
+                    csa_out.touch (csa_in.arrival_station [i]);
                     csa_out.n_transfers [csa_in.arrival_station [i] ] =
                         csa_out.n_transfers [csa_in.departure_station [i] ];
                 }
@@ -244,42 +484,152 @@ CSA_Return csa::main_csa_loop (
             csa::check_end_stations (end_stations_set, csa_in.arrival_station [i],
                     csa_in.arrival_time [i], csa_ret);
 
-            if (csa_in.transfer_map.find (csa_in.arrival_station [i]) != csa_in.transfer_map.end ())
+            const size_t arr_stn = csa_in.arrival_station [i];
+            const int new_n_transfers = csa_out.n_transfers [arr_stn] + 1;
+            const bool same_trip = csa_out.current_trip [arr_stn] == csa_in.trip_id [i];
+
+            for (size_t k = csa_in.transfer_map.begin (arr_stn);
+                    k < csa_in.transfer_map.end (arr_stn); k++)
             {
-                for (auto t: csa_in.transfer_map.at (csa_in.arrival_station [i]))
+                const size_t trans_dest = csa_in.transfer_map.dest [k];
+                const int ttime = csa_in.arrival_time [i] + csa_in.transfer_map.duration [k];
+
+                const bool time_is_better = ttime < csa_out.earliest_connection [trans_dest];
+                const bool time_is_equal = ttime == csa_out.earliest_connection [trans_dest];
+                const bool fewer_transfers = new_n_transfers < csa_out.n_transfers [trans_dest];
+
+                if ((time_is_better || (time_is_equal && fewer_transfers)) &&
+                        new_n_transfers <= csa_pars.max_transfers &&
+                        !(same_trip && new_n_transfers > csa_out.n_transfers [trans_dest]))
+                {
+                    DEBUGMSG_CSA("   main loop: incrementing transfer destination " <<
+                        trans_dest << " to " <<
+                        new_n_transfers << " transfers.",
+                        csa_in.departure_station [i]);
+
+                    // modified version of fill_one_csa_out:
+                    csa_out.touch (trans_dest);
+                    csa_out.earliest_connection [trans_dest] = ttime;
+                    csa_out.prev_stn [trans_dest] = arr_stn;
+                    csa_out.prev_time [trans_dest] = csa_in.arrival_time [i];
+                    csa_out.n_transfers [trans_dest] = new_n_transfers;
+
+                    csa::check_end_stations (end_stations_set,
+                            trans_dest, ttime, csa_ret);
+
+                }
+            }
+            csa_out.connect_trip (csa_in.trip_id [i]);
+        }
+        if (end_stations_set.size () == 0)
+            break;
+    }
+
+    return csa_ret;
+}
+
+// Backward version of main_csa_loop, which scans the sorted connections in
+// reverse to find latest departures for journeys arriving by arrival_time and
+// departing at or after csa_pars.start_time. Each connection is treated as
+// reversed in both direction and time, with times expressed as seconds prior
+// to arrival_time, so that csa_out holds the same values as a forward scan of
+// a reversed timetable starting at time 0. Connections are scanned in
+// decreasing order of departure, which ensures that all connections which
+// may follow any given connection are scanned before it.
+CSA_Return csa::main_csa_loop_reverse (
+        const CSA_Parameters &csa_pars,
+        const std::unordered_set <size_t> &start_stations_set,
+        std::unordered_set <size_t> &end_stations_set,
+        const CSA_Inputs &csa_in,
+        const int &arrival_time,
+        CSA_Outputs &csa_out)
+{
+
+    CSA_Return csa_ret;
+    csa_ret.earliest_time = INFINITE_INT;
+    csa_ret.end_station = INFINITE_INT;
+
+    // Connections departing after arrival_time can not be used:
+    const size_t last_con = static_cast <size_t> (std::upper_bound (
+                csa_in.departure_time.begin (), csa_in.departure_time.end (),
+                arrival_time) - csa_in.departure_time.begin ());
+
+    for (size_t i = last_con; i-- > 0; )
+    {
+        if (csa_in.departure_time [i] < csa_pars.start_time)
+            break;
+        if (csa_in.arrival_time [i] > arrival_time)
+            continue;
+
+        // The connection reversed in direction and time:
+        const size_t dep_stn = csa_in.arrival_station [i];
+        const size_t arr_stn = csa_in.departure_station [i];
+        const size_t trip = csa_in.trip_id [i];
+        const int dep_time = arrival_time - csa_in.arrival_time [i];
+        const int arr_time = arrival_time - csa_in.departure_time [i];
+
+        if (!trip_is_active (csa_pars.trip_active, trip))
+            continue;
+
+        if (start_stations_set.find (dep_stn) != start_stations_set.end () &&
+                arr_time <= csa_out.earliest_connection [arr_stn])
+        {
+            csa_out.connect_trip (trip);
+            csa::fill_one_csa_out_reverse (csa_out, csa_in, arr_stn, i,
+                    arrival_time);
+        }
+
+        if (((csa_out.earliest_connection [dep_stn] <= dep_time) &&
+                    csa_out.n_transfers [dep_stn] <= csa_pars.max_transfers) ||
+                csa_out.is_connected [trip])
+        {
+            const bool time_earlier = arr_time < csa_out.earliest_connection [arr_stn];
+            const bool time_equal = arr_time == csa_out.earliest_connection [arr_stn];
+            const bool less_transfers = csa_out.n_transfers [dep_stn] <
+                csa_out.n_transfers [arr_stn];
+
+            if (time_earlier || (time_equal && less_transfers))
+            {
+                csa::fill_one_csa_out_reverse (csa_out, csa_in, arr_stn, i,
+                        arrival_time);
+
+                if (!csa_out.is_connected [trip])
+                {
+                    csa_out.touch (arr_stn);
+                    csa_out.n_transfers [arr_stn] = csa_out.n_transfers [dep_stn];
+                }
+            }
+            csa::check_end_stations (end_stations_set, arr_stn, arr_time,
+                    csa_ret);
+
+            const int new_n_transfers = csa_out.n_transfers [arr_stn] + 1;
+            const bool same_trip = csa_out.current_trip [arr_stn] == trip;
+
+            for (size_t k = csa_in.transfer_map.begin (arr_stn);
+                    k < csa_in.transfer_map.end (arr_stn); k++)
+            {
+                const size_t trans_dest = csa_in.transfer_map.dest [k];
+                const int ttime = arr_time + csa_in.transfer_map.duration [k];
+
+                const bool time_is_better = ttime < csa_out.earliest_connection [trans_dest];
+                const bool time_is_equal = ttime == csa_out.earliest_connection [trans_dest];
+                const bool fewer_transfers = new_n_transfers < csa_out.n_transfers [trans_dest];
+
+                if ((time_is_better || (time_is_equal && fewer_transfers)) &&
+                        new_n_transfers <= csa_pars.max_transfers &&
+                        !(same_trip && new_n_transfers > csa_out.n_transfers [trans_dest]))
                 {
-                    size_t trans_dest = t.first;
-                    int ttime = csa_in.arrival_time [i] + t.second;
-                    int new_n_transfers = csa_out.n_transfers [csa_in.arrival_station [i]] + 1;
-
-                    const bool time_is_better = ttime < csa_out.earliest_connection [trans_dest];
-                    const bool time_is_equal = ttime == csa_out.earliest_connection [trans_dest];
-                    const bool fewer_transfers = new_n_transfers < csa_out.n_transfers [trans_dest];
-                    const bool same_trip =
-                        csa_out.current_trip [csa_in.arrival_station [i]] == csa_in.trip_id [i];
-
-                    if ((time_is_better || (time_is_equal && fewer_transfers)) &&
-                            new_n_transfers <= csa_pars.max_transfers &&
-                            !(same_trip && new_n_transfers > csa_out.n_transfers [trans_dest]))
-                    {
-                        DEBUGMSG_CSA("   main loop: incrementing transfer destination " <<
-                            trans_dest << " to " <<
-                            new_n_transfers << " transfers.",
-                            csa_in.departure_station [i]);
-
-                        // modified version of fill_one_csa_out:
-                        csa_out.earliest_connection [trans_dest] = ttime;
-                        csa_out.prev_stn [trans_dest] = csa_in.arrival_station [i];
-                        csa_out.prev_time [trans_dest] = csa_in.arrival_time [i];
-                        csa_out.n_transfers [trans_dest] = new_n_transfers;
-
-                        csa::check_end_stations (end_stations_set,
-                                trans_dest, ttime, csa_ret);
-
-                    }
+                    csa_out.touch (trans_dest);
+                    csa_out.earliest_connection [trans_dest] = ttime;
+                    csa_out.prev_stn [trans_dest] = arr_stn;
+                    csa_out.prev_time [trans_dest] = arr_time;
+                    csa_out.n_transfers [trans_dest] = new_n_transfers;
+
+                    csa::check_end_stations (end_stations_set,
+                            trans_dest, ttime, csa_ret);
                 }
             }
-            is_connected [csa_in.trip_id [i]] = true;
+            csa_out.connect_trip (trip);
         }
         if (end_stations_set.size () == 0)
             break;
@@ -312,6 +662,7 @@ void csa::fill_one_csa_out (
     }
 
     if (fill_vals) {
+        csa_out.touch (i);
         csa_out.earliest_connection [i] = csa_in.arrival_time [j];
         csa_out.current_trip [i] = csa_in.trip_id [j];
         csa_out.prev_stn [i] = csa_in.departure_station [j];
@@ -324,6 +675,35 @@ void csa::fill_one_csa_out (
     }
 }
 
+// Equivalent of fill_one_csa_out for connections reversed in direction and
+// time, as used in main_csa_loop_reverse.
+void csa::fill_one_csa_out_reverse (
+        CSA_Outputs &csa_out,
+        const CSA_Inputs &csa_in,
+        const size_t &i,
+        const size_t &j,
+        const int &arrival_time)
+{
+
+    const int arr_time = arrival_time - csa_in.departure_time [j];
+
+    bool fill_vals = (arr_time < csa_out.earliest_connection [i]);
+    if (!fill_vals) {
+        const size_t this_stn = csa_in.arrival_station [j];
+        const size_t prev_trip = csa_out.current_trip [this_stn];
+
+        fill_vals = (csa_in.trip_id [j] == prev_trip);
+    }
+
+    if (fill_vals) {
+        csa_out.touch (i);
+        csa_out.earliest_connection [i] = arr_time;
+        csa_out.current_trip [i] = csa_in.trip_id [j];
+        csa_out.prev_stn [i] = csa_in.arrival_station [j];
+        csa_out.prev_time [i] = arrival_time - csa_in.arrival_time [j];
+    }
+}
+
 void csa::check_end_stations (
         std::unordered_set <size_t> &end_stations_set,
         const size_t &arrival_station,
@@ -355,7 +735,8 @@ size_t csa::get_route_length (
         count++;
         i = csa_out.prev_stn [static_cast <size_t> (i)];
         if (count > csa_pars.nstations)
-            Rcpp::stop ("no route found; something went wrong"); // # nocov
+            // Not Rcpp::stop, because this may be called from threads:
+            throw std::runtime_error ("no route found; something went wrong"); // # nocov
     }
 
     return count;
@@ -401,3 +782,252 @@ void csa::extract_final_trip (
                 trip [j] = trip [j - 1];
     }
 }
+
+// Transpose a transfer graph, so that transfers *into* each station can be
+// scanned.
+void csa::transpose_transfer_graph (
+        const TransferGraph &transfer_map,
+        TransferGraph &transposed)
+{
+
+    const size_t n = transfer_map.offsets.size () - 1;
+    std::vector <size_t> from, to;
+    from.reserve (transfer_map.dest.size ());
+    to.reserve (transfer_map.dest.size ());
+    for (size_t s = 0; s < n; s++)
+        for (size_t k = transfer_map.begin (s); k < transfer_map.end (s); k++)
+        {
+            from.push_back (transfer_map.dest [k]);
+            to.push_back (s);
+        }
+
+    const std::vector <int> duration (transfer_map.duration.begin (),
+            transfer_map.duration.end ());
+    csa::make_transfer_graph (transposed, from, to, duration, n - 1);
+}
+
+// Shift all connections of each trip by shift [trip] seconds, and restore the
+// ordering by departure time. Connections with equal departure times retain
+// their previous order, with unshifted connections first. Only the range of
+// connections from the first to the last position of any shifted connection,
+// before or after shifting, is re-merged; all others remain in place. Arrays
+// are modified in place unless shared with other engines. Returns the number
+// of connections shifted.
+size_t csa::shift_trips (
+        CSA_Inputs &csa_in,
+        const std::vector <int> &shift)
+{
+
+    const size_t n = csa_in.departure_time.size ();
+
+    std::vector <size_t> moved;
+    int min_departure = INFINITE_INT, max_departure = -INFINITE_INT;
+    for (size_t i = 0; i < n; i++)
+    {
+        const int s = shift [csa_in.trip_id [i]];
+        if (s != 0)
+        {
+            moved.push_back (i);
+            min_departure = std::min (min_departure,
+                    csa_in.departure_time [i] + s);
+            max_departure = std::max (max_departure,
+                    csa_in.departure_time [i] + s);
+        }
+    }
+
+    if (moved.empty ())
+        return 0L;
+
+    // Unshifted connections departing no later than the earliest shifted
+    // departure precede all shifted connections, and those departing after
+    // the latest shifted departure follow them.
+    const int *dep = csa_in.departure_time.begin ();
+    const size_t lo = std::min (moved.front (), static_cast <size_t> (
+                std::upper_bound (dep, dep + n, min_departure) - dep));
+    const size_t hi = std::max (moved.back () + 1, static_cast <size_t> (
+                std::upper_bound (dep, dep + n, max_departure) - dep));
+
+    auto shifted_departure = [&] (const size_t i) {
+        return csa_in.departure_time [i] + shift [csa_in.trip_id [i]];
+    };
+    auto earlier = [&] (const size_t a, const size_t b) {
+        return shifted_departure (a) < shifted_departure (b);
+    };
+
+    std::vector <size_t> kept;
+    kept.reserve (hi - lo - moved.size ());
+    for (size_t i = lo; i < hi; i++)
+        if (shift [csa_in.trip_id [i]] == 0)
+            kept.push_back (i);
+
+    std::stable_sort (moved.begin (), moved.end (), earlier);
+    std::vector <size_t> index (hi - lo);
+    std::merge (kept.begin (), kept.end (), moved.begin (), moved.end (),
+            index.begin (), earlier);
+
+    // Values of the range in merged order, before any are over-written:
+    const size_t m = hi - lo;
+    std::vector <uint32_t> departure_station (m), arrival_station (m),
+        trip_id (m);
+    std::vector <int> departure_time (m), arrival_time (m);
+    for (size_t j = 0; j < m; j++)
+    {
+        const size_t i = index [j];
+        const int s = shift [csa_in.trip_id [i]];
+        departure_station [j] = csa_in.departure_station [i];
+        arrival_station [j] = csa_in.arrival_station [i];
+        trip_id [j] = csa_in.trip_id [i];
+        departure_time [j] = csa_in.departure_time [i] + s;
+        arrival_time [j] = csa_in.arrival_time [i] + s;
+    }
+
+    std::copy (departure_station.begin (), departure_station.end (),
+            csa_in.departure_station.mutable_data () + lo);
+    std::copy (arrival_station.begin (), arrival_station.end (),
+            csa_in.arrival_station.mutable_data () + lo);
+    std::copy (trip_id.begin (), trip_id.end (),
+            csa_in.trip_id.mutable_data () + lo);
+    std::copy (departure_time.begin (), departure_time.end (),
+            csa_in.departure_time.mutable_data () + lo);
+    std::copy (arrival_time.begin (), arrival_time.end (),
+            csa_in.arrival_time.mutable_data () + lo);
+
+    return moved.size ();
+}
+
+// Earliest arrival possible when departing at or after departure_time, or
+// INFINITE_INT if there is none.
+int csa::profile_arrival (
+        const ProfileType &profile,
+        const int &departure_time)
+{
+
+    // The profile is sorted by decreasing departure time, so the last entry
+    // departing at or after departure_time has the earliest arrival.
+    auto it = std::partition_point (profile.begin (), profile.end (),
+            [&] (const std::pair <int, int> &p) {
+                return p.first >= departure_time;
+            });
+
+    return (it == profile.begin ()) ? INFINITE_INT : std::prev (it)->second;
+}
+
+// Insert a (departure, arrival) pair unless it is dominated by an existing
+// entry, and remove any entries which it dominates. Returns true if inserted.
+bool csa::profile_insert (
+        ProfileType &profile,
+        const int &departure_time,
+        const int &arrival_time)
+{
+
+    if (csa::profile_arrival (profile, departure_time) <= arrival_time)
+        return false;
+
+    // Connections are scanned in decreasing order of departure, so insertion
+    // is generally at the end.
+    auto pos = std::partition_point (profile.begin (), profile.end (),
+            [&] (const std::pair <int, int> &p) {
+                return p.first > departure_time;
+            });
+    auto pos_end = pos;
+    while (pos_end != profile.end () && pos_end->second >= arrival_time)
+        pos_end++;
+
+    if (pos == pos_end)
+    {
+        profile.insert (pos, std::make_pair (departure_time, arrival_time));
+    } else
+    {
+        *pos = std::make_pair (departure_time, arrival_time);
+        profile.erase (pos + 1, pos_end);
+    }
+
+    return true;
+}
+
+// Profile Connection Scan, scanning all connections departing at or after
+// start_time once, from latest to earliest. The earliest arrival at any of
+// end_stations from each connection is the best of: arriving directly at, or
+// walking from the arrival station to, an end station; staying on the same
+// trip; or continuing with the profile of the arrival station. The resulting
+// (departure, arrival) pair is then added to the profile of the departure
+// station, and of all stations with transfers into it. Pairs for connections
+// departing from any stations flagged in is_source are also appended to the
+// three source_ vectors.
+void csa::profile_scan (
+        const CSA_Inputs &csa_in,
+        const TransferGraph &transfers_in,
+        const size_t nstations,
+        const size_t ntrips,
+        const std::vector <size_t> &end_stations,
+        const int &start_time,
+        const std::vector <bool> &is_source,
+        const uint64_t *trip_active,
+        std::vector <ProfileType> &profiles,
+        std::vector <size_t> &source_stn,
+        std::vector <int> &source_dep,
+        std::vector <int> &source_arr)
+{
+
+    const size_t n = nstations + 1;
+
+    profiles.clear ();
+    profiles.resize (n);
+
+    std::vector <int> walk_to_end (n, INFINITE_INT);
+    for (auto e: end_stations)
+        walk_to_end [e] = 0;
+    for (auto e: end_stations)
+        for (size_t k = transfers_in.begin (e); k < transfers_in.end (e); k++)
+        {
+            const size_t stn = transfers_in.dest [k];
+            walk_to_end [stn] = std::min (walk_to_end [stn],
+                    transfers_in.duration [k]);
+        }
+
+    std::vector <int> trip_arrival (ntrips + 1, INFINITE_INT);
+
+    const size_t first_con = csa::first_connection (csa_in.departure_time,
+            start_time);
+
+    for (size_t i = csa_in.departure_time.size (); i-- > first_con; )
+    {
+        const size_t arr_stn = csa_in.arrival_station [i];
+        const size_t dep_stn = csa_in.departure_station [i];
+        const size_t trip = csa_in.trip_id [i];
+        const int dep_time = csa_in.departure_time [i];
+
+        if (!trip_is_active (trip_active, trip))
+            continue;
+
+        int arrival = trip_arrival [trip];
+        if (walk_to_end [arr_stn] < INFINITE_INT)
+            arrival = std::min (arrival,
+                    csa_in.arrival_time [i] + walk_to_end [arr_stn]);
+        arrival = std::min (arrival,
+                csa::profile_arrival (profiles [arr_stn], csa_in.arrival_time [i]));
+
+        if (arrival == INFINITE_INT)
+            continue;
+
+        trip_arrival [trip] = arrival;
+
+        csa::profile_insert (profiles [dep_stn], dep_time, arrival);
+        // Profiles may include single transfers prior to boarding, but these
+        // are not chained, so are added regardless of whether the connection
+        // itself was inserted above:
+        for (size_t k = transfers_in.begin (dep_stn);
+                k < transfers_in.end (dep_stn); k++)
+        {
+            csa::profile_insert (profiles [transfers_in.dest [k]],
+                    dep_time - transfers_in.duration [k], arrival);
+        }
+
+        if (is_source [dep_stn])
+        {
+            source_stn.push_back (dep_stn);
+            source_dep.push_back (dep_time);
+            source_arr.push_back (arrival);
+        }
+    }
+}
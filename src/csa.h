@@ -1,6 +1,9 @@
 #pragma once
 
 #include <Rcpp.h>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 
 /* These lines dump debug info for the journey from DEPARTURE_STATION to
  * ARRIVAL_STATION, including all transfers from DEPARTURE_STATION.
@@ -22,14 +25,72 @@
 
 constexpr int INFINITE_INT =  std::numeric_limits<int>::max ();
 
-typedef std::unordered_map <size_t, std::unordered_map <size_t, int> > 
-    TransferMapType;
+// Array of values, which are either owned by the array itself, or held in
+// memory owned by some other object, such as a memory-mapped network file (see
+// csa-network.cpp). Arrays compiled from R inputs own their values, while
+// arrays of networks read from disk refer directly to the mapped file, so need
+// neither copying nor separate memory in each process. Copies of arrays share
+// the same values, which are only copied when modified through
+// `mutable_data`, and then only if they are shared with other arrays.
+template <typename T>
+class NetworkArray
+{
+    private:
+
+        std::shared_ptr <std::vector <T> > owned;
+        const T *first = nullptr;
+        size_t n = 0;
+
+    public:
+
+        NetworkArray &operator= (std::vector <T> &&x) {
+            owned = std::make_shared <std::vector <T> > (std::move (x));
+            first = owned->data ();
+            n = owned->size ();
+            return *this;
+        }
+
+        // Refer to 'size' values held elsewhere, which must outlive this array.
+        void view (const T *data, const size_t size) {
+            owned.reset ();
+            first = data;
+            n = size;
+        }
+
+        // Writable values, which are first copied if held elsewhere, or shared
+        // with any other arrays.
+        T *mutable_data () {
+            if (!owned || owned.use_count () > 1) {
+                owned = std::make_shared <std::vector <T> > (first, first + n);
+                first = owned->data ();
+            }
+            return owned->data ();
+        }
+
+        size_t size () const { return n; }
+        bool empty () const { return n == 0; }
+        const T &operator[] (const size_t i) const { return first [i]; }
+        const T *data () const { return first; }
+        const T *begin () const { return first; }
+        const T *end () const { return first + n; }
+};
+
+// Transfers (footpaths) between stations in compressed sparse row form. The
+// transfers from station s are at indices [offsets [s], offsets [s + 1]) of
+// dest and duration, so iterating over them involves no hashing.
+struct TransferGraph
+{
+    NetworkArray <size_t> offsets, dest;
+    NetworkArray <int> duration;
+
+    size_t begin (const size_t s) const { return offsets [s]; }
+    size_t end (const size_t s) const { return offsets [s + 1]; }
+};
 
 // ---- csa-timetable.cpp
 struct Timetable_Inputs
 {
-    std::vector <std::string> stop_id, trip_id;
-    std::vector <int> arrival_time, departure_time;
+    std::vector <int> stop_id, trip_id, arrival_time, departure_time;
 };
 
 struct Timetable_Outputs
@@ -41,54 +102,130 @@ struct Timetable_Outputs
 namespace timetable {
     void timetable_in_from_df (Rcpp::DataFrame &stop_times,
             Timetable_Inputs &tt_in);
-    size_t count_connections (const Timetable_Inputs &tt_in);
+    size_t trip_blocks (const Timetable_Inputs &tt_in,
+            std::vector <size_t> &block_start,
+            std::vector <size_t> &block_offset);
     void initialise_tt_outputs (Timetable_Outputs &tt_out, size_t n);
-    void make_trip_stop_map (const std::vector <std::string> &input,
-            std::unordered_map <std::string, int> &output_map);
     void make_timetable (const Timetable_Inputs &tt_in,
             Timetable_Outputs &tt_out,
-            const std::vector <std::string> &stop_ids,
-            const std::vector <std::string> &trip_ids);
+            const std::vector <size_t> &block_start,
+            const std::vector <size_t> &block_offset);
 }
 
-Rcpp::DataFrame rcpp_make_timetable (Rcpp::DataFrame stop_times,
-        std::vector <std::string> stop_ids, std::vector <std::string> trip_ids);
+Rcpp::DataFrame rcpp_make_timetable (Rcpp::DataFrame stop_times);
 
 // ---- csa.cpp
 struct CSA_Parameters
 {
     size_t timetable_size, ntrips, nstations;
     int start_time, max_transfers;
+    // Trips active on the day of the query; see TripServices:
+    const uint64_t *trip_active = nullptr;
 };
 
+// Connections are held as separate arrays of 32-bit values, which are all read
+// together in the main scans. Stations and trips are used as direct array
+// indices, and are stored as unsigned 32-bit values rather than size_t to halve
+// the memory (and bandwidth) they require, so each connection occupies 20
+// rather than 32 bytes. This store is shared by the routing and traveltimes
+// scans.
 struct CSA_Inputs
 {
-    // stations and trips are size_t because they're used as direct array indices.
-    std::vector <size_t> departure_station,
+    NetworkArray <uint32_t> departure_station,
         arrival_station, trip_id;
-    std::vector <int> departure_time, arrival_time;
-    TransferMapType transfer_map;
+    NetworkArray <int> departure_time, arrival_time;
+    TransferGraph transfer_map;
 };
 
+// Days on which trips operate, for timetables compiled from all trips of a
+// feed. Each day has one bitset over all trips, so the trips active on any one
+// day occupy a contiguous block of `nwords` words, and scans can be restricted
+// to any day without the timetable being re-compiled. Days are indices into
+// the service calendar constructed in R.
+struct TripServices
+{
+    size_t ndays = 0, nwords = 0;
+    std::vector <uint64_t> bits;
+
+    // Bits of trips active on day 'd', or nullptr for negative days, for which
+    // all trips are active.
+    const uint64_t *day (const int d) const {
+        return d < 0 ? nullptr : bits.data () + static_cast <size_t> (d) * nwords;
+    }
+};
+
+// Scans skip all connections of inactive trips.
+inline bool trip_is_active (const uint64_t *active, const size_t trip)
+{
+    return active == nullptr || ((active [trip >> 6] >> (trip & 63)) & 1u);
+}
+
 class CSA_Outputs
 {
+    private:
+        // Stations and trips modified since the last reset:
+        std::vector <size_t> touched_stns, touched_trips;
+        std::vector <bool> is_touched;
+
     public:
         std::vector <int> earliest_connection;
         std::vector <int> prev_time;
         std::vector <int> n_transfers;
         std::vector <size_t> prev_stn;
         std::vector <size_t> current_trip;
+        std::vector <bool> is_connected;
 
-        CSA_Outputs (const size_t n) {
+        CSA_Outputs (const size_t n, const size_t ntrips) {
             earliest_connection.resize (n, INFINITE_INT);
             prev_time.resize (n, INFINITE_INT);
             n_transfers.resize (n, 0);
             prev_stn.resize (n, INFINITE_INT);
             current_trip.resize (n, INFINITE_INT);
+            is_touched.resize (n, false);
+            is_connected.resize (ntrips, false);
+        }
+
+        // Must be called before modifying any values for station s.
+        void touch (const size_t s) {
+            if (!is_touched [s]) {
+                is_touched [s] = true;
+                touched_stns.push_back (s);
+            }
+        }
+
+        void connect_trip (const size_t t) {
+            if (!is_connected [t]) {
+                is_connected [t] = true;
+                touched_trips.push_back (t);
+            }
+        }
+
+        // Restore initial values, so that outputs can be re-used between
+        // queries without re-allocating. Only those values modified by the
+        // previous query are reset, so this costs nothing like the full size
+        // of the outputs for short queries.
+        void reset () {
+            for (auto s: touched_stns) {
+                earliest_connection [s] = INFINITE_INT;
+                prev_time [s] = INFINITE_INT;
+                n_transfers [s] = 0;
+                prev_stn [s] = INFINITE_INT;
+                current_trip [s] = INFINITE_INT;
+                is_touched [s] = false;
+            }
+            for (auto t: touched_trips)
+                is_connected [t] = false;
+            touched_stns.clear ();
+            touched_trips.clear ();
         }
 };
 
 
+// Profiles hold, for one station, the Pareto set of (departure, earliest
+// arrival) pairs to a set of target stations. They are sorted by decreasing
+// departure time, and so also by strictly decreasing arrival time.
+typedef std::vector <std::pair <int, int> > ProfileType;
+
 struct CSA_Return
 {
     size_t end_station;
@@ -105,6 +242,10 @@ void fill_csa_pars (
         size_t ntrips,
         size_t nstations);
 
+size_t first_connection (
+        const NetworkArray <int> &departure_time,
+        const int &start_time);
+
 void make_station_sets (
         const std::vector <size_t> &start_stations,
         const std::vector <size_t> &end_stations,
@@ -115,15 +256,40 @@ void csa_in_from_df (
         Rcpp::DataFrame &timetable,
         CSA_Inputs &csa_in);
 
-void make_transfer_map (
-        TransferMapType &transfer_map,
+void check_csa_inputs (
+        const CSA_Inputs &csa_in,
+        const size_t nstations,
+        const size_t ntrips);
+
+Rcpp::List input_columns (
+        Rcpp::DataFrame &timetable,
         Rcpp::DataFrame &transfers);
 
+uint64_t inputs_fingerprint (const Rcpp::List &columns);
+
+uint64_t inputs_fingerprint (
+        Rcpp::DataFrame &timetable,
+        Rcpp::DataFrame &transfers);
+
+bool same_columns (const Rcpp::List &a, const Rcpp::List &b);
+
+void make_transfer_map (
+        TransferGraph &transfer_map,
+        Rcpp::DataFrame &transfers,
+        const size_t nstations);
+
+void make_transfer_graph (
+        TransferGraph &transfer_map,
+        const std::vector <size_t> &trans_from,
+        const std::vector <size_t> &trans_to,
+        const std::vector <int> &trans_time,
+        const size_t nstations);
+
 void get_earliest_connection (
         const std::vector <size_t> &start_stations,
         const int &start_time,
-        const TransferMapType &transfer_map,
-        std::vector <int> &earliest_connection);
+        const TransferGraph &transfer_map,
+        CSA_Outputs &csa_out);
 
 CSA_Return main_csa_loop (
         const CSA_Parameters &csa_pars,
@@ -132,11 +298,25 @@ CSA_Return main_csa_loop (
         const CSA_Inputs &csa_inputs,
         CSA_Outputs &csa_out);
 
+CSA_Return main_csa_loop_reverse (
+        const CSA_Parameters &csa_pars,
+        const std::unordered_set <size_t> &start_stations_set,
+        std::unordered_set <size_t> &end_stations_set,
+        const CSA_Inputs &csa_inputs,
+        const int &arrival_time,
+        CSA_Outputs &csa_out);
+
 void fill_one_csa_out (
         CSA_Outputs &csa_out,
         const CSA_Inputs &csa_in,
         const size_t &i, const size_t &j);
 
+void fill_one_csa_out_reverse (
+        CSA_Outputs &csa_out,
+        const CSA_Inputs &csa_in,
+        const size_t &i, const size_t &j,
+        const int &arrival_time);
+
 void check_end_stations (
         std::unordered_set <size_t> &end_stations_set,
         const size_t &arrival_station,
@@ -155,6 +335,65 @@ void extract_final_trip (
         std::vector <size_t> &trip,
         std::vector <int> &time);
 
+Rcpp::DataFrame route_query (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations);
+
+void route_query_vectors (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        std::vector <size_t> &end_station_out,
+        std::vector <size_t> &trip_out,
+        std::vector <int> &time_out);
+
+void route_query_vectors_reverse (
+        const CSA_Parameters &csa_pars,
+        const CSA_Inputs &csa_in,
+        CSA_Outputs &csa_out,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        const int &arrival_time,
+        std::vector <size_t> &end_station_out,
+        std::vector <size_t> &trip_out,
+        std::vector <int> &time_out);
+
+void transpose_transfer_graph (
+        const TransferGraph &transfer_map,
+        TransferGraph &transposed);
+
+size_t shift_trips (
+        CSA_Inputs &csa_in,
+        const std::vector <int> &shift);
+
+int profile_arrival (
+        const ProfileType &profile,
+        const int &departure_time);
+
+bool profile_insert (
+        ProfileType &profile,
+        const int &departure_time,
+        const int &arrival_time);
+
+void profile_scan (
+        const CSA_Inputs &csa_in,
+        const TransferGraph &transfers_in,
+        const size_t nstations,
+        const size_t ntrips,
+        const std::vector <size_t> &end_stations,
+        const int &start_time,
+        const std::vector <bool> &is_source,
+        const uint64_t *trip_active,
+        std::vector <ProfileType> &profiles,
+        std::vector <size_t> &source_stn,
+        std::vector <int> &source_dep,
+        std::vector <int> &source_arr);
+
 } // end namespace csa
 
 
@@ -167,3 +406,299 @@ Rcpp::DataFrame rcpp_csa (
         const std::vector <size_t> end_stations,
         const int start_time,
         const int max_transfers);
+
+// ---- csa-network.cpp
+// Compiled networks can be written to a binary file, and read back by memory
+// mapping the file, so that the arrays of the network are used directly from
+// the file without any copying, and are shared between all processes reading
+// the same file. Files start with this fixed header, followed by each array in
+// the order: connections (departure_station, arrival_station, trip_id,
+// departure_time, arrival_time); transfers (offsets, dest, duration); the
+// transposed transfers into each station, in the same form; stop times
+// (trip, stop, arrival_time, departure_time); and dictionaries of stop IDs
+// and names, and of trip IDs, route IDs, route names, and headsigns, each as
+// consecutive nul-terminated strings. Each array starts at a multiple of 8
+// bytes. Everything needed for routing is held in the file, so reading only
+// checks the header and the size of the file.
+struct NetworkHeader
+{
+    char magic [8];
+    uint32_t version, byte_order;
+    uint64_t nstations, ntrips, nconnections, ntransfers, nstop_times;
+    // Checksum of the timetable and transfers of the network, in the forms
+    // returned by `rcpp_network_tables`:
+    uint64_t fingerprint;
+    uint64_t stop_ids_size, stop_names_size, trip_ids_size, route_ids_size,
+             route_names_size, headsigns_size;
+};
+
+constexpr char NETWORK_MAGIC [8] = "GTFSNET";
+// Increment whenever the layout of network files changes:
+constexpr uint32_t NETWORK_VERSION = 2;
+// Written in native byte order, so files from machines of the other order can
+// be detected:
+constexpr uint32_t NETWORK_BYTE_ORDER = 0x01020304;
+
+// A read-only network file, which is memory-mapped where possible, and
+// otherwise read into memory, and released on destruction.
+class NetworkFile
+{
+    private:
+
+        const char *mapped = nullptr;
+        size_t nbytes = 0;
+        // Contents of files which can not be mapped:
+        std::vector <char> buffer;
+
+    public:
+
+        NetworkFile (const std::string &filename);
+        ~NetworkFile ();
+
+        NetworkFile (const NetworkFile &) = delete;
+        NetworkFile &operator= (const NetworkFile &) = delete;
+
+        const char *data () const { return mapped; }
+        size_t size () const { return nbytes; }
+};
+
+Rcpp::List rcpp_network_read (const std::string filename);
+
+Rcpp::List rcpp_network_tables (SEXP engine);
+
+void rcpp_network_write (SEXP engine,
+        const std::string filename,
+        Rcpp::DataFrame stops,
+        Rcpp::DataFrame trips,
+        Rcpp::DataFrame stop_times);
+
+namespace network {
+
+size_t array_bytes (
+        const size_t n,
+        const size_t size);
+
+Rcpp::CharacterVector read_dictionary (
+        const char *data,
+        const size_t size,
+        const size_t n);
+
+void check_transfer_graph (
+        const TransferGraph &graph,
+        const size_t nstations,
+        const size_t ntransfers);
+
+} // end namespace network
+
+// ---- csa-engine.cpp
+// Compiled form of a timetable and transfer table, constructed once and held
+// in memory as an R external pointer, so that repeated queries need neither
+// re-convert the inputs nor re-allocate the outputs.
+struct CSA_Engine
+{
+    size_t nstations, ntrips;
+    CSA_Inputs csa_in;
+    // File holding csa_in for engines read from disk:
+    std::shared_ptr <NetworkFile> network_file;
+    CSA_Outputs csa_out;
+    // Outputs for each thread of batch queries:
+    std::vector <CSA_Outputs> thread_out;
+    // Transfers into each station, for profile scans:
+    TransferGraph transfers_in;
+    // Optional days of operation of each trip:
+    TripServices services;
+    // Real-time delays of each trip, and bits of cancelled trips, both of which
+    // are empty until updates are applied:
+    std::vector <int> trip_delay;
+    std::vector <uint64_t> cancelled;
+    // Trips which are active on the day of a query, not cancelled, and in the
+    // trip mask of the query:
+    std::vector <uint64_t> trip_active;
+    // Checksum of the timetable and transfers from which the engine was
+    // compiled (see `csa::inputs_fingerprint`), and the columns last found to
+    // match it. Those columns are marked as not mutable, so that any
+    // modification in R makes new copies which are then checked again:
+    uint64_t fingerprint = 0;
+    Rcpp::List input_columns;
+
+    CSA_Engine (const size_t nstations_in, const size_t ntrips_in) :
+        nstations (nstations_in), ntrips (ntrips_in),
+        csa_out (nstations_in + 1, ntrips_in + 1) {}
+
+    void hold_input_columns (const Rcpp::List &columns)
+    {
+        for (size_t i = 0; i < columns.size (); i++)
+        {
+            SEXP x = columns [i];
+            MARK_NOT_MUTABLE (x);
+        }
+        input_columns = columns;
+    }
+};
+
+SEXP rcpp_csa_engine (
+        Rcpp::DataFrame timetable,
+        Rcpp::DataFrame transfers,
+        const size_t nstations,
+        const size_t ntrips);
+
+int rcpp_csa_engine_size (SEXP engine);
+
+int rcpp_csa_engine_last_departure (SEXP engine);
+
+bool rcpp_csa_engine_matches (
+        SEXP engine,
+        Rcpp::DataFrame timetable,
+        Rcpp::DataFrame transfers);
+
+Rcpp::XPtr <CSA_Engine> engine_ptr (SEXP engine);
+
+SEXP rcpp_csa_engine_copy (SEXP engine);
+
+void rcpp_csa_engine_services (
+        SEXP engine,
+        const std::vector <int> trip_service,
+        Rcpp::LogicalMatrix service_days);
+
+const uint64_t *engine_trip_active (
+        CSA_Engine &engine,
+        const int service_day,
+        const Rcpp::LogicalVector &trip_mask);
+
+int rcpp_csa_engine_update (
+        SEXP engine,
+        const std::vector <int> trips,
+        const std::vector <int> delays,
+        Rcpp::LogicalVector cancelled);
+
+void check_engine_stations (
+        const std::vector <size_t> &stations,
+        const size_t nstations,
+        const std::string &type);
+
+Rcpp::DataFrame rcpp_csa_engine_query (
+        SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+Rcpp::DataFrame rcpp_csa_engine_batch (
+        SEXP engine,
+        Rcpp::List start_stations,
+        Rcpp::List end_stations,
+        const std::vector <int> start_times,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+Rcpp::DataFrame rcpp_csa_engine_reverse (
+        SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int arrival_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+Rcpp::DataFrame rcpp_csa_profile (
+        SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int end_time,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+// ---- csa-pareto.cpp
+// Labels for multi-criteria scans, with one level for each number of trips
+// used, and level [0] for stations reached without any trips. Each level
+// holds earliest arrival times at each station, along with the connections
+// at which the final trip was boarded and alighted, and the station from which
+// any final transfer was made.
+struct Pareto_Labels
+{
+    size_t nstations;
+    std::vector <std::vector <int> > arrival;
+    std::vector <std::vector <size_t> > board, alight, walk_from;
+    // Earliest arrival at any end station for each level:
+    std::vector <int> end_arrival;
+    std::vector <size_t> end_station;
+    std::vector <bool> is_end;
+    // For each trip, the fewest trips with which it can be reached, including
+    // itself, and the connection at which it was boarded to achieve that:
+    std::vector <size_t> trip_ntrips, trip_board;
+
+    Pareto_Labels (const size_t nstations_in, const size_t ntrips_in) :
+        nstations (nstations_in), is_end (nstations_in, false),
+        trip_ntrips (ntrips_in, INFINITE_INT),
+        trip_board (ntrips_in, INFINITE_INT) {}
+
+    void add_level () {
+        arrival.push_back (std::vector <int> (nstations, INFINITE_INT));
+        board.push_back (std::vector <size_t> (nstations, INFINITE_INT));
+        alight.push_back (std::vector <size_t> (nstations, INFINITE_INT));
+        walk_from.push_back (std::vector <size_t> (nstations, INFINITE_INT));
+        end_arrival.push_back (INFINITE_INT);
+        end_station.push_back (INFINITE_INT);
+    }
+
+    // Earliest arrival at any end station using no more than ntrips trips:
+    int best_end_arrival (const size_t ntrips) const {
+        int best = INFINITE_INT;
+        for (size_t k = 0; k <= ntrips && k < end_arrival.size (); k++)
+            best = std::min (best, end_arrival [k]);
+        return best;
+    }
+};
+
+namespace pareto {
+
+void initialise (
+        const CSA_Inputs &csa_in,
+        const std::vector <size_t> &start_stations,
+        const int &start_time,
+        Pareto_Labels &labels);
+
+int best_arrival (
+        const Pareto_Labels &labels,
+        const size_t &stn,
+        const size_t &ntrips);
+
+bool set_label (
+        Pareto_Labels &labels,
+        const size_t &ntrips,
+        const size_t &stn,
+        const int &arrival_time);
+
+void scan (
+        const CSA_Inputs &csa_in,
+        const std::vector <size_t> &start_stations,
+        const std::vector <size_t> &end_stations,
+        const int &start_time,
+        const size_t &max_trips,
+        const uint64_t *trip_active,
+        Pareto_Labels &labels);
+
+void extract_journeys (
+        const CSA_Inputs &csa_in,
+        const Pareto_Labels &labels,
+        std::vector <int> &journey,
+        std::vector <int> &ntransfers,
+        std::vector <size_t> &stop_number,
+        std::vector <int> &time,
+        std::vector <size_t> &trip_number);
+
+} // end namespace pareto
+
+Rcpp::DataFrame rcpp_csa_pareto (
+        SEXP engine,
+        const std::vector <size_t> start_stations,
+        const std::vector <size_t> end_stations,
+        const int start_time,
+        const int max_transfers,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
@@ -0,0 +1,260 @@
+#include "stop-times.h"
+#include "convert-time.h"
+
+#include <cstring> // memcpy
+
+// FNV-1a
+uint64_t StringPool::hash (const char *p, const size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= static_cast <unsigned char> (p [i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void StringPool::grow ()
+{
+    std::vector <int> old_slots;
+    old_slots.swap (slots);
+    slots.assign (old_slots.size () * 2L, 0L);
+    const size_t mask = slots.size () - 1L;
+
+    for (auto s: old_slots)
+    {
+        if (s == 0)
+            continue;
+        const size_t i = static_cast <size_t> (s - 1);
+        size_t pos = hash (chars.data () + offsets [i],
+                offsets [i + 1] - offsets [i]) & mask;
+        while (slots [pos] != 0)
+            pos = (pos + 1L) & mask;
+        slots [pos] = s;
+    }
+}
+
+int StringPool::intern (const char *p, const size_t len)
+{
+    const size_t mask = slots.size () - 1L;
+    size_t pos = hash (p, len) & mask;
+    while (slots [pos] != 0)
+    {
+        const size_t i = static_cast <size_t> (slots [pos] - 1);
+        if (offsets [i + 1] - offsets [i] == len &&
+                (len == 0 || std::memcmp (chars.data () + offsets [i], p, len) == 0))
+            return static_cast <int> (i);
+        pos = (pos + 1L) & mask;
+    }
+
+    const int code = static_cast <int> (size ());
+    chars.insert (chars.end (), p, p + len);
+    offsets.push_back (chars.size ());
+    slots [pos] = code + 1;
+    if (2L * size () > slots.size ())
+        grow ();
+
+    return code;
+}
+
+// Stream a CSV file in blocks of BUFFER_SIZE, with values of each field
+// accumulated in a single re-used buffer, so memory is bounded by the output
+// columns of one integer per row. The first row is the header, the names of
+// which are used to create `columns`. Quoted fields may contain delimiters,
+// line breaks, and escaped quotes, and may span blocks. Leading and trailing
+// spaces and tabs outside of quotes are removed from all fields, including
+// those of the header, as done by `data.table::fread`, which reads all other
+// tables of feeds. Blank lines are skipped, and rows with fewer fields than
+// the header have empty values for the remaining columns.
+void stoptimes::read_stop_times (
+        std::FILE *file,
+        std::vector <StopTimesColumn> &columns)
+{
+    std::vector <char> buffer (BUFFER_SIZE);
+    std::string field;
+    std::vector <std::string> header;
+
+    bool in_header = true, in_quotes = false, quote_pending = false,
+         first_block = true;
+    size_t col = 0, nrows = 0;
+    bool row_empty = true;
+    // Length of the field at the end of its last quoted part, which is not
+    // trimmed:
+    size_t quoted_len = 0;
+
+    auto is_blank = [] (const char ch) { return ch == ' ' || ch == '\t'; };
+
+    auto end_field = [&] () {
+        while (field.size () > quoted_len && is_blank (field.back ()))
+            field.pop_back ();
+        if (in_header)
+        {
+            header.push_back (field);
+        } else if (col < columns.size ())
+        {
+            StopTimesColumn &c = columns [col];
+            if (c.is_time)
+                c.values.push_back (convert_time_to_seconds (field.data (),
+                            field.size ()));
+            else
+                c.values.push_back (c.pool.intern (field.data (), field.size ()));
+        }
+        col++;
+        field.clear ();
+        quoted_len = 0;
+    };
+
+    auto end_row = [&] () {
+        if (row_empty && field.empty ())
+        {
+            col = 0;
+            return;
+        }
+        end_field ();
+        if (in_header)
+        {
+            for (const auto &h: header)
+            {
+                const bool is_time =
+                    h.find ("arrival_time") != std::string::npos ||
+                    h.find ("departure_time") != std::string::npos;
+                columns.emplace_back (h, is_time);
+            }
+            in_header = false;
+        } else
+        {
+            nrows++;
+            for (; col < columns.size (); col++)
+            {
+                StopTimesColumn &c = columns [col];
+                c.values.push_back (c.is_time ? 0L : c.pool.intern ("", 0L));
+            }
+        }
+        col = 0;
+        row_empty = true;
+    };
+
+    size_t n;
+    while ((n = std::fread (buffer.data (), 1L, buffer.size (), file)) > 0)
+    {
+        size_t i = 0;
+        // Skip any UTF-8 byte order mark:
+        if (first_block && n >= 3 &&
+                static_cast <unsigned char> (buffer [0]) == 0xEF &&
+                static_cast <unsigned char> (buffer [1]) == 0xBB &&
+                static_cast <unsigned char> (buffer [2]) == 0xBF)
+            i = 3;
+        first_block = false;
+
+        for (; i < n; i++)
+        {
+            const char ch = buffer [i];
+            if (quote_pending)
+            {
+                // A quote within quotes is either escaped by a second quote,
+                // or closes the quoted part of the field.
+                quote_pending = false;
+                if (ch == '"')
+                {
+                    field.push_back ('"');
+                    continue;
+                }
+                in_quotes = false;
+                quoted_len = field.size ();
+            }
+
+            if (in_quotes)
+            {
+                if (ch == '"')
+                    quote_pending = true;
+                else
+                    field.push_back (ch);
+            } else if (ch == '"')
+            {
+                in_quotes = true;
+                row_empty = false;
+            } else if (ch == ',')
+            {
+                end_field ();
+                row_empty = false;
+            } else if (ch == '\n')
+            {
+                end_row ();
+            } else if (is_blank (ch) && field.empty ())
+            {
+                // Leading blanks are skipped
+            } else if (ch != '\r')
+            {
+                field.push_back (ch);
+                row_empty = false;
+            }
+        }
+    }
+    if (quote_pending)
+        quoted_len = field.size ();
+    if (!row_empty || !field.empty ())
+        end_row ();
+
+    if (in_header)
+        throw std::runtime_error ("stop_times file is empty");
+}
+
+//' rcpp_read_stop_times
+//'
+//' Read a GTFS "stop_times" file with a streaming parser. Arrival and
+//' departure times are converted directly to integer seconds, and all other
+//' values are interned as they are read, so each distinct value is only
+//' converted to an R string once, rather than once for each row.
+//'
+//' @return A list of the columns of the file, with names from the header.
+//' Times are integer vectors, and all other columns are character vectors,
+//' which are converted to other types in R where needed.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_stop_times (const std::string filename)
+{
+    std::FILE *file = std::fopen (filename.c_str (), "rb");
+    if (file == nullptr)
+        Rcpp::stop ("Unable to open stop_times file " + filename);
+
+    std::vector <StopTimesColumn> columns;
+    try {
+        stoptimes::read_stop_times (file, columns);
+    } catch (const std::exception &e) {
+        std::fclose (file);
+        Rcpp::stop (e.what ());
+    }
+    std::fclose (file);
+
+    const size_t ncols = columns.size ();
+    Rcpp::List res (ncols);
+    Rcpp::CharacterVector names (ncols);
+
+    for (size_t j = 0; j < ncols; j++)
+    {
+        StopTimesColumn &c = columns [j];
+        names [j] = c.name;
+        const size_t nrows = c.values.size ();
+
+        if (c.is_time)
+        {
+            res [j] = c.values;
+        } else
+        {
+            Rcpp::CharacterVector values (c.pool.size ());
+            for (size_t i = 0; i < c.pool.size (); i++)
+                values [i] = c.pool.str (i);
+
+            Rcpp::CharacterVector column (nrows);
+            for (size_t i = 0; i < nrows; i++)
+                column [i] = values [c.values [i]];
+            res [j] = column;
+        }
+        std::vector <int> ().swap (c.values);
+    }
+    res.attr ("names") = names;
+
+    return res;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+
+// Unique strings, each stored once in a single contiguous buffer, with
+// 0-based codes in order of first appearance. Lookups hash the characters of
+// each value in place, so no strings are constructed for values already held.
+class StringPool
+{
+    private:
+        std::vector <char> chars;
+        std::vector <size_t> offsets;
+        // Open-addressed hash table of (code + 1), or 0 for empty slots:
+        std::vector <int> slots;
+
+        static uint64_t hash (const char *p, const size_t len);
+        void grow ();
+
+    public:
+        StringPool () : offsets (1L, 0L), slots (1024L, 0L) {}
+
+        int intern (const char *p, const size_t len);
+        size_t size () const { return offsets.size () - 1L; }
+        std::string str (const size_t i) const {
+            return std::string (chars.data () + offsets [i],
+                    offsets [i + 1] - offsets [i]);
+        }
+};
+
+// Columns of stop_times hold either times in seconds, or codes of values
+// interned in the `pool` of that column.
+struct StopTimesColumn
+{
+    std::string name;
+    bool is_time;
+    std::vector <int> values;
+    StringPool pool;
+
+    StopTimesColumn (const std::string &name_in, const bool is_time_in) :
+        name (name_in), is_time (is_time_in) {}
+};
+
+namespace stoptimes {
+
+// Size of the buffer in which files are streamed:
+constexpr size_t BUFFER_SIZE = 1L << 20;
+
+void read_stop_times (
+        std::FILE *file,
+        std::vector <StopTimesColumn> &columns);
+
+} // end namespace stoptimes
+
+Rcpp::List rcpp_read_stop_times (const std::string filename);
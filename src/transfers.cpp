@@ -22,81 +22,163 @@ double transfers::one_haversine (const double &x1, const double &y1,
 }
 
 
-// [[Rcpp::export]]
-Rcpp::List rcpp_transfer_nbs (Rcpp::DataFrame stops,
-        const double dlim)
+//' Grid of stops in cells of latitude and longitude
+//'
+//' Cells are at least as large as the maximal differences in latitude and
+//' longitude between any two stops within distance `dlim`, so all neighbours
+//' of each stop lie within the same or adjacent cells. Stops with non-finite
+//' coordinates, which can not have neighbours, are not included.
+//'
+//' @noRd
+transfers::StopGrid::StopGrid (const std::vector <double> &x,
+        const std::vector <double> &y, const double dlim)
 {
-    const size_t n = static_cast <size_t> (stops.nrow ());
+    const size_t n = x.size ();
 
-    const std::vector <double> stop_x = stops ["stop_lon"];
-    const std::vector <double> stop_y = stops ["stop_lat"];
-
-    Rcpp::List res (n * 2);
-    // Initialize res:
+    double ymin = INFINITY, ymax = -INFINITY, xmin = INFINITY, xmax = -INFINITY;
     for (size_t i = 0; i < n; i++)
     {
-        res (i) = std::vector <size_t> ();
-        res (i + n) = std::vector <double> ();
+        if (!std::isfinite (x [i]) || !std::isfinite (y [i]))
+            continue;
+        ymin = std::min (ymin, y [i]);
+        ymax = std::max (ymax, y [i]);
+        xmin = std::min (xmin, x [i]);
+        xmax = std::max (xmax, x [i]);
     }
+    x0 = std::isfinite (xmin) ? xmin : 0.0;
+    y0 = std::isfinite (ymin) ? ymin : 0.0;
+
+    // Haversine distances are at least 'earth' times differences in latitude,
+    // and sin^2 of half differences in longitude are at most sin^2 (dlim / 2
+    // earth) divided by the product of the cosines of both latitudes. Cells
+    // are slightly enlarged to allow for rounding.
+    const double margin = 1.0 + 1.0e-6;
+    const double dang = std::max (dlim, 0.0) / earth;
+    dy = std::max (dang * 180.0 / pi * margin, MIN_CELL);
+
+    const double ylim = std::max (std::fabs (ymin), std::fabs (ymax));
+    const double cosy = cos (std::min (ylim, 90.0) * pi / 180.0);
+    const double s = sin (dang / 2.0);
+    dx = 360.0;
+    if (s < cosy)
+        dx = std::max (2.0 * asin (s / cosy) * 180.0 / pi * margin, MIN_CELL);
+
+    // Differences in longitude wrap around the antimeridian, so feeds which
+    // may have neighbours across it are placed in a single column:
+    if (!(xmax - xmin + 2.0 * dx < 360.0))
+        dx = INFINITY;
 
-    for (size_t i = 0; i < (n - 1); i++)
+    // Limit numbers of rows and columns to the range of the cell indices:
+    const double max_cells = static_cast <double> (1L << 30);
+    if (std::isfinite (ymax) && (ymax - ymin) / dy > max_cells)
+        dy = (ymax - ymin) / max_cells;
+    if (std::isfinite (xmax) && (xmax - xmin) / dx > max_cells)
+        dx = (xmax - xmin) / max_cells;
+
+    std::vector <std::pair <int64_t, size_t> > keys;
+    keys.reserve (n);
+    for (size_t i = 0; i < n; i++)
     {
-        const double cosy1 = cos (stop_y [i] * pi / 180.0);
+        if (!std::isfinite (x [i]) || !std::isfinite (y [i]))
+            continue;
+        keys.emplace_back (cell_key (row (y [i]), col (x [i])), i);
+    }
+    std::sort (keys.begin (), keys.end ());
 
-        std::vector <size_t> index;
-        std::vector <double> dist;
-        for (size_t j = (i + 1); j < n; j++)
-        {
-            const double cosy2 = cos (stop_y [j] * pi / 180.0);
-            const double d_j = transfers::one_haversine (stop_x [i], stop_y [i],
-                    stop_x [j], stop_y [j], cosy1, cosy2);
-            if (d_j <= dlim)
-            {
-                index.push_back (j);
-                dist.push_back (d_j);
-            }
-        } // end for j
+    stops.resize (keys.size ());
+    for (size_t i = 0; i < keys.size (); i++)
+    {
+        stops [i] = keys [i].second;
+        if (i == 0 || keys [i].first != keys [i - 1].first)
+            cells.emplace (keys [i].first, std::make_pair (i, i));
+        cells [keys [i].first].second = i + 1;
+    }
+}
 
-        // Each vector in 'res' needs to be extended by these new values:
-        std::vector <size_t> index_i = res (i);
-        std::vector <double> dist_i = res (n + i);
-        for (size_t j = 0; j < index.size (); j++)
+// All stops in the cell containing (x, y) and its eight neighbours, including
+// the stop itself, in no particular order.
+void transfers::StopGrid::candidates (const double x, const double y,
+        std::vector <size_t> &out) const
+{
+    out.clear ();
+    const int64_t r = row (y), c = col (x);
+    for (int64_t ri = r - 1; ri <= r + 1; ri++)
+    {
+        for (int64_t ci = c - 1; ci <= c + 1; ci++)
         {
-            index_i.push_back (index [j]);
-            dist_i.push_back (dist [j]);
+            const auto cell = cells.find (cell_key (ri, ci));
+            if (cell == cells.end ())
+                continue;
+            out.insert (out.end (), stops.begin () + cell->second.first,
+                    stops.begin () + cell->second.second);
         }
+    }
+}
 
-        res (i) = index_i;
-        res (n + i) = dist_i;
+//' rcpp_transfer_nbs
+//'
+//' Find all pairs of stops within distance `dlim` of each other. Stops are
+//' placed in a grid with cells of about `dlim`, and each stop is only compared
+//' with stops in adjacent cells, so the number of distance calculations is
+//' proportional to numbers of stops and their neighbours, rather than to the
+//' square of the number of stops.
+//'
+//' @return A list of 2n vectors, the first n of which are the 1-based indices
+//' of the neighbours of each stop in increasing order, and the second n the
+//' corresponding distances.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_transfer_nbs (Rcpp::DataFrame stops,
+        const double dlim)
+{
+    const size_t n = static_cast <size_t> (stops.nrow ());
 
-        // But the 'j' values are only incrementally obtained, so have to be
-        // expanded each time. Each element of 'index' has to be mapped back to
-        // the 'res' entry, which needs an 'i' appended. Each element of 'dist'
-        // maps back to 'res(index[j])`, and has to have 'd(i,j)' appended.
-        for (size_t j = 0; j < index.size (); j++)
-        {
-            std::vector <size_t> vec_j = res (index [j]);
-            vec_j.push_back (i);
-            res (index [j]) = vec_j;
+    const std::vector <double> stop_x = stops ["stop_lon"];
+    const std::vector <double> stop_y = stops ["stop_lat"];
 
-            std::vector <double> dist_j = res (index [j] + n);
-            dist_j.push_back (dist [j]);
-            res (index [j] + n) = dist_j;
-        }
+    std::vector <double> cosy (n);
+    for (size_t i = 0; i < n; i++)
+        cosy [i] = cos (stop_y [i] * pi / 180.0);
 
-        index.clear ();
-        dist.clear ();
-    }
+    const transfers::StopGrid grid (stop_x, stop_y, dlim);
+
+    Rcpp::List res (n * 2);
+    std::vector <size_t> nbs;
+    std::vector <size_t> index;
+    std::vector <double> dist;
 
-    // Then increment all 'index' values by 1 for 1-based R:
     for (size_t i = 0; i < n; i++)
     {
-        std::vector <size_t> vec_i = res (i);
-        for (size_t j = 0; j < vec_i.size (); j++)
+        index.clear ();
+        dist.clear ();
+
+        if (std::isfinite (stop_x [i]) && std::isfinite (stop_y [i]))
         {
-            vec_i [j] = vec_i [j] + 1;
+            grid.candidates (stop_x [i], stop_y [i], nbs);
+            std::sort (nbs.begin (), nbs.end ());
+
+            for (auto j: nbs)
+            {
+                if (j == i)
+                    continue;
+                // Distances are always calculated from the lower to the
+                // higher index, so both directions have identical values:
+                const size_t a = std::min (i, j), b = std::max (i, j);
+                const double d_j = transfers::one_haversine (
+                        stop_x [a], stop_y [a], stop_x [b], stop_y [b],
+                        cosy [a], cosy [b]);
+                if (d_j <= dlim)
+                {
+                    // Increment index values by 1 for 1-based R:
+                    index.push_back (j + 1);
+                    dist.push_back (d_j);
+                }
+            }
         }
-        res (i) = vec_i;
+
+        res (i) = index;
+        res (n + i) = dist;
     }
 
     return res;
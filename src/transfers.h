@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
@@ -30,6 +33,36 @@ double one_haversine (const double &x1, const double &y1,
         const double &x2, const double &y2,
         const double &cosy1, const double &cosy2);
 
+// Minimal size of grid cells in degrees, for distance limits of zero:
+constexpr double MIN_CELL = 1.0e-9;
+
+class StopGrid
+{
+    private:
+        double x0, y0, dx, dy;
+        // Indices of stops sorted by cell, and ranges of those for each cell:
+        std::vector <size_t> stops;
+        std::unordered_map <int64_t, std::pair <size_t, size_t> > cells;
+
+        int64_t row (const double y) const {
+            return static_cast <int64_t> (std::floor ((y - y0) / dy));
+        }
+        int64_t col (const double x) const {
+            return std::isfinite (dx) ?
+                static_cast <int64_t> (std::floor ((x - x0) / dx)) : 0L;
+        }
+        static int64_t cell_key (const int64_t r, const int64_t c) {
+            return r * (static_cast <int64_t> (1) << 32) + c;
+        }
+
+    public:
+        StopGrid (const std::vector <double> &x,
+                const std::vector <double> &y, const double dlim);
+
+        void candidates (const double x, const double y,
+                std::vector <size_t> &out) const;
+};
+
 } // end namespace transfers
 
 Rcpp::List rcpp_transfer_nbs (Rcpp::DataFrame stops,
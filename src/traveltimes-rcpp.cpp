@@ -1,115 +1,314 @@
 #include "traveltimes.h"
 
+#include <numeric> // accumulate
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 // Minimal Rcpp interfaces to R. All of the main work done in traveltimes.cpp,
 // which is then pure C++.
 
 //' rcpp_traveltimes
 //'
-//' Calculate isochrones using Connection Scan Algorithm for GTFS data. Works
-//' largely as rcpp_csa. Returns a list of integer vectors, with [i] holding
-//' sequences of stations on a given route, the end one being the terminal
-//' isochrone point, and [i+1] holding correpsonding trip numbers.
+//' Calculate isochrones using Connection Scan Algorithm for GTFS data, using
+//' the timetable and transfers of a compiled engine. Returns an integer matrix
+//' with one row for each station which is reached, and columns of (station,
+//' start_time, duration, ntransfers), so the size of the result scales only
+//' with the area reached.
+//'
+//' If `return_paths` is `TRUE`, the result has an additional "paths"
+//' attribute holding the journeys to all reached stations as a tree of legs;
+//' see `iso::trace_back_paths`.
+//'
+//' Scans only use trips operating on `service_day` of the engine's service
+//' calendar, or all trips if that is negative, and only those trips which are
+//' `TRUE` in `trip_mask`, unless that is empty.
 //'
 //' All elements of all data are 1-indexed
 //'
 //' @noRd
 // [[Rcpp::export]]
-Rcpp::IntegerMatrix rcpp_traveltimes (Rcpp::DataFrame timetable,
-        Rcpp::DataFrame transfers,
-        const size_t nstations,
+Rcpp::IntegerMatrix rcpp_traveltimes (SEXP engine,
         const std::vector <size_t> start_stations,
         const int start_time_min,
         const int start_time_max,
         const bool minimise_transfers,
-        const int max_traveltime)
+        const int max_traveltime,
+        const bool return_paths,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
 {
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const CSA_Engine &eng = *ptr;
+
+    check_engine_stations (start_stations, eng.nstations, "Start");
 
-    // make start and end stations into std::unordered_sets to allow
-    // constant-time lookup. stations are submitted as 0-based, while all other
-    // values in timetable and transfers table are 1-based R indices, so all are
-    // converted below to 0-based.
-    std::unordered_set <size_t> start_stations_set;
-    for (auto s: start_stations)
-        start_stations_set.emplace (s);
-
-    // convert transfers into a map from start to (end, transfer_time). Transfer
-    // indices are 1-based.
-    std::unordered_map <size_t, std::unordered_map <size_t, int> > transfer_map;
-    iso::make_transfer_map (transfer_map,
-            transfers ["from_stop_id"],
-            transfers ["to_stop_id"],
-            transfers ["min_transfer_time"]);
-
-    Iso iso (nstations + 1, max_traveltime);
-
-    const std::vector <size_t> departure_station = timetable ["departure_station"],
-        arrival_station = timetable ["arrival_station"],
-        trip_id = timetable ["trip_id"];
-    const std::vector <int> departure_time = timetable ["departure_time"],
-        arrival_time = timetable ["arrival_time"];
+    // make start stations into std::unordered_set to allow constant-time
+    // lookup.
+    std::unordered_set <size_t> start_stations_set (start_stations.begin (),
+            start_stations.end ());
+
+    Iso iso (eng.nstations + 1, eng.ntrips + 1, max_traveltime);
+    iso.trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+    IsoPaths paths (return_paths ? eng.nstations + 1 : 0L);
+    if (return_paths)
+        iso.paths = &paths;
 
     iso::trace_forward_traveltimes (
             iso,
             start_time_min,
             start_time_max,
-            departure_station,
-            arrival_station,
-            trip_id, 
-            departure_time,
-            arrival_time,
-            transfer_map,
+            eng.csa_in,
             start_stations_set,
             minimise_transfers);
 
-    Rcpp::IntegerMatrix res = iso::trace_back_traveltimes (
-            iso,
-            minimise_transfers);
+    Rcpp::IntegerMatrix res = iso::trace_back_traveltimes (iso);
+
+    if (return_paths)
+        res.attr ("paths") = iso::trace_back_paths (paths, res);
 
     return res;
 }
 
 
-Rcpp::IntegerMatrix iso::trace_back_traveltimes (
-        const Iso & iso,
-        const bool &minimise_transfers
-        )
+//' rcpp_traveltimes_percentiles
+//'
+//' Distributions of travel times for departures at each minute between
+//' `start_time_min` and `start_time_max`, from a single scan of the timetable
+//' of a compiled engine. Departures which do not reach a station within
+//' `max_traveltime` are considered to have infinite travel times.
+//'
+//' Returns an integer matrix with one row for each station (including the
+//' initial dummy station 0), and columns of the number of departures which
+//' reach that station, followed by travel times at each of the specified
+//' `percentiles`, or INT_MAX where these are not reached.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::IntegerMatrix rcpp_traveltimes_percentiles (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const int start_time_min,
+        const int start_time_max,
+        const int max_traveltime,
+        const std::vector <double> percentiles,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
 {
-    const int nst = static_cast <int> (iso.is_end_stn.size ());
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const CSA_Engine &eng = *ptr;
+    const size_t nstations = eng.nstations;
 
-    Rcpp::IntegerMatrix res (nst, 3);
+    check_engine_stations (start_stations, nstations, "Start");
 
-    size_t count = 0;
+    std::unordered_set <size_t> start_stations_set (start_stations.begin (),
+            start_stations.end ());
 
-    for (auto s: iso.connections)
+    Iso iso (nstations + 1, eng.ntrips + 1, max_traveltime);
+    iso.trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+    IsoProfile profile (nstations + 1, start_time_min, start_time_max,
+            max_traveltime, 60L);
+    iso.profile = &profile;
+
+    iso::trace_forward_traveltimes (iso, start_time_min, start_time_max,
+            eng.csa_in, start_stations_set, false);
+
+    const size_t npercentiles = percentiles.size ();
+    Rcpp::IntegerMatrix res (static_cast <int> (nstations + 1),
+            static_cast <int> (npercentiles + 1));
+
+    for (size_t stn = 0; stn <= nstations; stn++)
     {
-        int ntransfers = INFINITE_INT;
-        int duration = INFINITE_INT;
-        int start_time = INFINITE_INT;
-        
-        for (auto con: s.convec)
-        {
-            if (con.is_transfer)
-                continue;
+        iso::flush_profile (profile, stn, INFINITE_INT);
+
+        int nreached = 0;
+        if (profile.hist_offset [stn] < INFINITE_INT)
+            nreached = std::accumulate (
+                    profile.hist.begin () + profile.hist_offset [stn],
+                    profile.hist.begin () + profile.hist_offset [stn] +
+                        profile.nbins, 0);
+        res (stn, 0) = nreached;
 
-            int this_duration = con.arrival_time - con.initial_depart;
+        for (size_t p = 0; p < npercentiles; p++)
+            res (stn, p + 1) = iso::profile_percentile (profile, stn,
+                    percentiles [p]);
+    }
 
-            bool update = (minimise_transfers && con.ntransfers < ntransfers);
-            if (!update && !minimise_transfers)
-                update = this_duration < duration ||
-                    (this_duration == duration && con.ntransfers < ntransfers);
+    return res;
+}
 
-            if (update)
+//' rcpp_traveltimes_matrix
+//'
+//' Travel times from multiple origins using a compiled engine, with origins
+//' processed in parallel. `start_stations` is a list of integer vectors of
+//' stations for each origin. All origins share the timetable and transfers of
+//' the engine, and each thread re-uses one `Iso` object for all of its
+//' origins.
+//'
+//' Returns a list of three integer matrices of "start_time", "duration", and
+//' "ntransfers", each with one row for each origin, and one column for each
+//' station, excluding the initial dummy station 0. Values for stations which
+//' can not be reached are INT_MAX.
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_traveltimes_matrix (SEXP engine,
+        Rcpp::List start_stations,
+        const int start_time_min,
+        const int start_time_max,
+        const bool minimise_transfers,
+        const int max_traveltime,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask)
+{
+    Rcpp::XPtr <CSA_Engine> ptr = engine_ptr (engine);
+    const CSA_Engine &eng = *ptr;
+    const uint64_t *trip_active = engine_trip_active (*ptr, service_day, trip_mask);
+
+    // Conversion from R objects must be done before threads are started:
+    const size_t norigins = static_cast <size_t> (start_stations.size ());
+    std::vector <std::unordered_set <size_t> > starts (norigins);
+    for (size_t i = 0; i < norigins; i++)
+    {
+        const std::vector <size_t> s =
+            Rcpp::as <std::vector <size_t> > (start_stations [i]);
+        check_engine_stations (s, eng.nstations, "Start");
+        starts [i] = std::unordered_set <size_t> (s.begin (), s.end ());
+    }
+
+    // Each origin fills one row of each matrix, so results are written
+    // directly in the origin-by-destination layout returned to R:
+    Rcpp::IntegerMatrix start_time (norigins, eng.nstations),
+        duration (norigins, eng.nstations),
+        ntransfers (norigins, eng.nstations);
+    int *start_time_out = start_time.begin (),
+        *duration_out = duration.begin (),
+        *ntransfers_out = ntransfers.begin ();
+
+    std::string err_msg;
+
+    #pragma omp parallel
+    {
+        Iso iso (eng.nstations + 1, eng.ntrips + 1, max_traveltime);
+        iso.trip_active = trip_active;
+
+        #pragma omp for schedule(dynamic)
+        for (size_t i = 0; i < norigins; i++)
+        {
+            iso.reset ();
+            try {
+                iso::trace_forward_traveltimes (iso,
+                        start_time_min, start_time_max,
+                        eng.csa_in, starts [i], minimise_transfers);
+            } catch (const std::exception &e) { // # nocov start
+                #pragma omp critical
+                err_msg = e.what ();
+            } // # nocov end
+
+            for (size_t j = 0; j < eng.nstations; j++)
             {
-                ntransfers = con.ntransfers;
-                duration = this_duration;
-                start_time = con.initial_depart;
+                const size_t pos = i + j * norigins;
+                start_time_out [pos] = iso.start_time [j + 1];
+                duration_out [pos] = iso.duration [j + 1];
+                ntransfers_out [pos] = iso.ntransfers [j + 1];
             }
         }
+    }
+
+    if (!err_msg.empty ())
+        Rcpp::stop (err_msg); // # nocov
+
+    Rcpp::List res = Rcpp::List::create (
+            Rcpp::Named ("start_time") = start_time,
+            Rcpp::Named ("duration") = duration,
+            Rcpp::Named ("ntransfers") = ntransfers);
+
+    return res;
+}
+
+
+// Only stations touched by the scan need be considered, of which those
+// reached only by transfers have no travel times. These are returned in order
+// of station number.
+Rcpp::IntegerMatrix iso::trace_back_traveltimes (
+        const Iso & iso
+        )
+{
+    std::vector <size_t> stations;
+    stations.reserve (iso.touched_stations ().size ());
+    for (const auto &stn: iso.touched_stations ())
+        if (iso.duration [stn] < INFINITE_INT)
+            stations.push_back (stn);
+    std::sort (stations.begin (), stations.end ());
 
-        res (count, 0) = start_time;
-        res (count, 1) = duration;
-        res (count++, 2) = ntransfers;
+    const int nreached = static_cast <int> (stations.size ());
+    Rcpp::IntegerMatrix res (nreached, 4);
+
+    for (size_t i = 0; i < stations.size (); i++)
+    {
+        const size_t stn = stations [i];
+        res (i, 0) = static_cast <int> (stn);
+        res (i, 1) = iso.start_time [stn];
+        res (i, 2) = iso.duration [stn];
+        res (i, 3) = iso.ntransfers [stn];
+    }
+
+    return res;
+}
+
+// Convert the tree of legs to R, retaining only those legs which lead to the
+// best journey to some station, renumbered as 1-based indices in the same
+// order, so parents still precede their children. Returns a list of "leg",
+// the final leg to each station in the rows of `traveltimes`, and "legs", an
+// integer matrix of (parent, trip, departure_station, departure_time,
+// arrival_station, arrival_time), with parents of 0 for initial legs, and trips
+// of INT_MAX for transfers.
+Rcpp::List iso::trace_back_paths (
+        const IsoPaths & paths,
+        const Rcpp::IntegerMatrix & traveltimes
+        )
+{
+    const size_t nlegs_all = paths.size ();
+    const size_t nstations = static_cast <size_t> (traveltimes.nrow ());
+
+    // Mark all legs of best journeys, stopping at any already marked:
+    std::vector <int> index (nlegs_all, 0L);
+    for (size_t i = 0; i < nstations; i++)
+    {
+        for (int leg = paths.best [traveltimes (i, 0)];
+                leg >= 0 && index [leg] == 0;
+                leg = paths.parent [leg])
+            index [leg] = 1L;
     }
 
+    int nlegs = 0;
+    for (size_t i = 0; i < nlegs_all; i++)
+        if (index [i] > 0)
+            index [i] = ++nlegs;
+
+    Rcpp::IntegerMatrix legs (nlegs, 6);
+    for (size_t i = 0; i < nlegs_all; i++)
+    {
+        if (index [i] == 0)
+            continue;
+
+        const int row = index [i] - 1;
+        const int parent = paths.parent [i];
+        legs (row, 0) = parent < 0 ? 0L : index [parent];
+        legs (row, 1) = paths.trip [i];
+        legs (row, 2) = paths.departure_station [i];
+        legs (row, 3) = paths.departure_time [i];
+        legs (row, 4) = paths.arrival_station [i];
+        legs (row, 5) = paths.arrival_time [i];
+    }
+
+    Rcpp::IntegerVector leg (nstations);
+    for (size_t i = 0; i < nstations; i++)
+        leg [i] = index [paths.best [traveltimes (i, 0)]];
+
+    Rcpp::List res = Rcpp::List::create (
+            Rcpp::Named ("leg") = leg,
+            Rcpp::Named ("legs") = legs);
+
     return res;
 }
@@ -4,89 +4,73 @@ void iso::trace_forward_traveltimes (
         Iso & iso,
         const int & start_time_min,
         const int & start_time_max,
-        const std::vector <size_t> & departure_station,
-        const std::vector <size_t> & arrival_station,
-        const std::vector <size_t> & trip_id,
-        const std::vector <int> & departure_time,
-        const std::vector <int> & arrival_time,
-        const std::unordered_map <size_t, std::unordered_map <size_t, int> > & transfer_map,
+        const CSA_Inputs & csa_in,
         const std::unordered_set <size_t> & start_stations_set,
         const bool & minimise_transfers)
 {
-    const size_t nrows = departure_station.size ();
+    const TransferGraph &transfer_map = csa_in.transfer_map;
 
-    std::unordered_map <size_t, bool> stations;
-    for (size_t a: arrival_station)
-        stations.emplace (std::make_pair (a, false));
+    const size_t first_con = csa::first_connection (csa_in.departure_time,
+            start_time_min);
+    const size_t end_con = iso::end_connection (csa_in.departure_time,
+            start_time_max, iso.get_max_traveltime ());
 
-    for (size_t i = 0; i < nrows; i++)
+    for (size_t i = first_con; i < end_con; i++)
     {
-        if (departure_time [i] < start_time_min)
-            continue; // # nocov - these lines already removed in R fn.
+        if (!trip_is_active (iso.trip_active, csa_in.trip_id [i]))
+            continue;
 
         // connections can also arrive at one of the departure stations, and
         // these are also flagged as start stations to prevent transfers being
         // constructed from the arrival/start station.
         const bool arrive_at_start =
-            iso::is_start_stn (start_stations_set, arrival_station [i]);
+            iso::is_start_stn (start_stations_set, csa_in.arrival_station [i]);
         const bool is_start_stn = arrive_at_start ||
-            iso::is_start_stn (start_stations_set, departure_station [i]);
+            iso::is_start_stn (start_stations_set, csa_in.departure_station [i]);
 
-        if (arrive_at_start || (is_start_stn && departure_time [i] > start_time_max))
+        if (arrive_at_start || (is_start_stn && csa_in.departure_time [i] > start_time_max))
             continue;
 
+        // Trips can only be boarded from stations which have been reached,
+        // and any trip already being ridden will also have reached this one.
         if (!is_start_stn &&
-                (iso.earliest_departure [departure_station [i]] == INFINITE_INT ||
-                 (iso.earliest_departure [departure_station [i]] < INFINITE_INT &&
-                  iso.earliest_departure [departure_station [i]] > departure_time [i])))
+                iso.earliest_departure [csa_in.departure_station [i]] >
+                csa_in.departure_time [i])
         {
             continue;
         }
 
-        bool filled = iso::fill_one_iso (departure_station [i],
-                arrival_station [i], trip_id [i], departure_time [i],
-                arrival_time [i], is_start_stn,
+        bool filled = iso::fill_one_iso (csa_in.departure_station [i],
+                csa_in.arrival_station [i], csa_in.trip_id [i],
+                csa_in.departure_time [i], csa_in.arrival_time [i],
+                is_start_stn,
                 minimise_transfers, iso);
 
-        if (filled && !stations.at (arrival_station [i]))
-        {
-            stations [arrival_station [i]] = true;
-        }
-
         // Exclude transfers from start stations; see #88. These can't be
         // included because they can't be allocated a start time from the
         // timetable, so are effectively considered to take no time, allowing
         // the algorithm to jump to nearby stations at same start time, which
         // mucks everything up.
-        if (!is_start_stn && filled && transfer_map.find (arrival_station [i]) != transfer_map.end ())
+        if (!is_start_stn && filled)
         {
-            for (auto t: transfer_map.at (arrival_station [i]))
+            for (size_t k = transfer_map.begin (csa_in.arrival_station [i]);
+                    k < transfer_map.end (csa_in.arrival_station [i]); k++)
             {
-                const size_t trans_dest = t.first;
-                const int trans_duration = t.second;
+                const size_t trans_dest = transfer_map.dest [k];
+                const int trans_duration = transfer_map.duration [k];
 
                 if (!iso::is_start_stn (start_stations_set, trans_dest))
                 {
                     iso::fill_one_transfer (
-                            departure_station [i],
-                            arrival_station [i],
-                            arrival_time [i],
+                            csa_in.trip_id [i],
+                            csa_in.arrival_station [i],
+                            csa_in.arrival_time [i],
                             trans_dest,
                             trans_duration,
-                            minimise_transfers,
                             iso);
-
-                    if (stations.find (trans_dest) !=
-                            stations.end ())
-                    {
-                        if (!stations.at (trans_dest))
-                        {
-                            stations [trans_dest] = true;
-                        }
-                    }
                 }
 
-            } // end for t over transfer map
+            } // end for k over transfer graph
         } // end if filled
     } // end for i over nrows of timetable
 }
@@ -95,11 +79,12 @@ void iso::trace_forward_traveltimes (
 
 //' Translate one timetable line into values at arrival station
 //'
-//' The trace_back function requires each connection to have a corresponding
-//' initial departure time and number of transfers. For each connection from a
-//' departure to an arrival station, these have to be worked out by looping over
-//' all connections to the departure station, and finding the best previous
-//' connection in order to copy respective values across.
+//' Each trip holds the non-dominated pairs of (initial departure time, number
+//' of transfers) with which it may be ridden. These are first updated with all
+//' labels at the departure station which may board the trip, with one
+//' additional transfer, and then propagated as labels to the arrival station.
+//' Both station and trip labels are Pareto sets, so journeys which are slower
+//' but with fewer transfers are retained, allowing either to be minimised.
 //'
 //' @noRd
 bool iso::fill_one_iso (
@@ -112,525 +97,472 @@ bool iso::fill_one_iso (
         const bool &minimise_transfers,
         Iso &iso) {
 
-    bool fill_vals = false, is_end_stn = false, same_trip = false;
-    bool is_transfer = false;
-    // is_transfer is used to increment "implicit" transfers to different
-    // services from same stop_id, which do not otherwise appear as transfers.
-
-    int ntransfers = INFINITE_INT;
-    int latest_initial = -1L;
-
     if (is_start_stn)
     {
-        fill_vals = true;
-        ntransfers = 0;
-        latest_initial = departure_time;
+        iso::board_trip (iso, trip_id, departure_time, 0L, -1L,
+                departure_station, departure_time);
     } else
     {
-        // fill_vals determines whether a connection is viable, which is if it
-        // arrives at departure station prior to nominated departure time, and
-        // arrives within isochrone time.
-        //
-        // This loop also determines whether a station is an end station, which
-        // happens if the arrival time would extend beyond the isochrone value.
-        // This requires one or more connections to meet this condition with no
-        // conditions failing it. That requires an additional bool variable,
-        // not_end_stn, which is set to true when any connection arrives within
-        // time, while is_end_stn is only set to true when one or more
-        // connections can reach the departure yet not arrival station. The
-        // final value of is_end_stn is then only true is also !not_end_stn.
-
-        bool not_end_stn = false;
-
-        for (auto st: iso.connections [departure_station].convec)
+        const size_t nboard = iso::settle_labels (iso, departure_station,
+                departure_time);
+        for (size_t j = 0; j < nboard; j++)
         {
-            // don't fill any connections > max_traveltime
-            if ((arrival_time - st.initial_depart) > iso.get_max_traveltime ())
-                continue;
-
-            bool fill_here = (st.arrival_time <= departure_time);
-
-            if (fill_here)
-                not_end_stn = true;
-            else if (!not_end_stn)
-                is_end_stn = is_end_stn ||
-                    ((departure_time - st.initial_depart) <= iso.get_max_traveltime ());
+            const Iso::OneCon &st = iso.con (departure_station, j);
+            iso::board_trip (iso, trip_id, st.initial_depart,
+                    st.ntransfers + 1, st.leg,
+                    departure_station, departure_time);
+        }
+    }
 
-            if (fill_here || is_end_stn)
-            {
-                // Bunch of AND conditions written separately for clarity.
-                same_trip = (st.trip == trip_id);
-                // only follow same trip if it has equal fewest transfers
-                bool update = (minimise_transfers &&
-                        same_trip &&
-                        st.ntransfers <= ntransfers &&
-                        st.initial_depart > latest_initial);
-
-                if (!update)
-                {
-                    update = (ntransfers == INFINITE_INT);
-                }
+    // Remove any ways of riding the trip which now exceed max_traveltime;
+    // these can not be used at any subsequent stops either.
+    size_t ntrip = 0;
+    for (size_t j = 0; j < iso.trip_size (trip_id); j++)
+    {
+        const Iso::OnTrip ot = iso.on_trip (trip_id, j);
+        if ((arrival_time - ot.initial_depart) <= iso.get_max_traveltime ())
+            iso.on_trip (trip_id, ntrip++) = ot;
+    }
+    iso.truncate_trip (trip_id, ntrip);
 
-                if (!same_trip)
-                {
-                    // only update if departure is after listed initial depart
-                    update = departure_time > st.initial_depart;
-                    // and if connection is a transfer, then only if
-                    // arrival_time < listed departure time
-                    if (update && st.is_transfer)
-                    {
-                        update = departure_time >= st.arrival_time;
-                    }
-
-                    // for !minimise_transfers, update if:
-                    // 1. st.initial_depart > latest_initial OR
-                    // 2. st.ntransfers < ntransfers &&
-                    //      st.initial_depart == latest_initial
-                    if (update)
-                    {
-                        update = iso::update_best_connection (
-                                st.initial_depart,
-                                latest_initial,
-                                st.ntransfers,
-                                ntransfers,
-                                minimise_transfers);
-                    }
-                }
+    if (ntrip == 0)
+        return false;
 
-                if (update)
-                {
-                    DEBUGMSG("   update: (" << departure_station << " -> " <<
-                            arrival_station << "), time(" <<
-                            departure_time << " -> " <<
-                            arrival_time << "); (dur, tr) = (" <<
-                            arrival_time - st.initial_depart <<
-                            ", " << st.ntransfers <<
-                            "); init = " << latest_initial <<
-                            " -> " << st.initial_depart <<
-                            "; prev_stn = " << st.prev_stn <<
-                            " on trip#" << st.trip << " -> " << trip_id <<
-                            "; is_transfer = " << st.is_transfer,
-                            departure_station, arrival_station,
-                            departure_time);
-
-                    latest_initial = st.initial_depart;
-                    ntransfers = st.ntransfers;
-                    is_transfer = st.is_transfer;
-                }
-            }
+    iso.touch (arrival_station);
+    if (iso.earliest_departure [arrival_station] > arrival_time)
+        iso.earliest_departure [arrival_station] = arrival_time;
 
-            // fill_vals will remain true whenever any single fill_here is true,
-            // while is_end_stn = true must imply that fill_vals is false.
-            fill_vals = fill_vals || fill_here;
+    for (size_t j = 0; j < ntrip; j++)
+    {
+        Iso::OnTrip &ot = iso.on_trip (trip_id, j);
 
-            if (same_trip)
-                break;
-        }
+        Iso::OneCon label;
+        label.arrival_time = arrival_time;
+        label.ntransfers = ot.ntransfers;
+        label.initial_depart = ot.initial_depart;
+        if (iso.paths)
+            label.leg = iso.paths->add (ot.parent, trip_id, ot.board_station,
+                    ot.board_time, arrival_station, arrival_time);
 
-        DEBUGMSG("--stn: (" << departure_station << " -> " <<
+        DEBUGMSG("--con: (" << departure_station << " -> " <<
                 arrival_station << "), time(" <<
                 departure_time << " -> " <<
                 arrival_time << "), dur = " <<
-                arrival_time - latest_initial <<
-                " with " << ntransfers << " transfers",
+                arrival_time - label.initial_depart <<
+                " with " << label.ntransfers << " transfers",
                 departure_station, arrival_station,
                 departure_time);
 
-        is_end_stn = is_end_stn && !not_end_stn;
-
-        if (is_end_stn)
-        {
-            iso.is_end_stn [departure_station] = true;
-        } else
-        {
-            iso.is_end_stn [departure_station] = false;
-            iso.is_end_stn [arrival_station] = false;
-        }
-
-    }
-
-    if (!fill_vals)
-        return false;
-
-    const size_t s = iso.extend (arrival_station) - 1;
-
-    DEBUGMSG("--con: (" << departure_station << " -> " <<
-            arrival_station << "), time(" <<
-            departure_time << " -> " <<
-            arrival_time << "), dur = " <<
-            arrival_time - latest_initial <<
-            " with " << ntransfers << " transfers",
-            departure_station, arrival_station,
-            departure_time);
-
-    iso.connections [arrival_station].convec [s].prev_stn = departure_station;
-    iso.connections [arrival_station].convec [s].departure_time = departure_time;
-    iso.connections [arrival_station].convec [s].arrival_time = arrival_time;
-    iso.connections [arrival_station].convec [s].trip = trip_id;
-
-    if (iso.earliest_departure [arrival_station] > arrival_time)
-        iso.earliest_departure [arrival_station] = arrival_time;
-            
-    if (is_start_stn)
-    {
-        iso.connections [arrival_station].convec [s].ntransfers = 0L;
-        iso.connections [arrival_station].convec [s].initial_depart = departure_time;
-        iso.earliest_departure [departure_station] = departure_time;
-        iso.earliest_departure [arrival_station] = departure_time;
-    } else
-    {
-        if (!same_trip && !is_transfer)
+        const bool best = iso::update_traveltime (iso, arrival_station,
+                arrival_time, label.initial_depart, label.ntransfers,
+                minimise_transfers);
+        if (iso.profile)
+            iso::update_profile (*iso.profile, arrival_station, arrival_time,
+                    label.initial_depart, departure_time);
+        const bool inserted = iso::insert_label (iso, arrival_station, label);
+
+        // Legs of labels which are neither best nor retained are never used,
+        // and are immediately removed. Transfers may then re-create them.
+        if (iso.paths)
         {
-            // connections flagged with 'is_transfer' have already had transfers
-            // incremented; this increments only "implicit" transfers from same
-            // stop_id to different service (trip_id)
-            ntransfers++;
+            if (best)
+                iso.paths->best [arrival_station] = label.leg;
+            else if (!inserted)
+            {
+                iso.paths->pop ();
+                label.leg = -1L;
+            }
+            ot.leg = label.leg;
         }
-        iso.connections [arrival_station].convec [s].ntransfers = ntransfers;
-        iso.connections [arrival_station].convec [s].initial_depart = latest_initial;
     }
 
-    return fill_vals;
+    return true;
 }
 
 
-// Transfers are used to define the `earliest_departure` time, which is
-// important to enable timetable lines to be skipped if:
+// Transfers extend all ways of riding the trip which arrived at
+// arrival_station. They do not themselves increment numbers of transfers,
+// which is done when the subsequent trip is boarded. Transfers are used to
+// define the `earliest_departure` time, which is important to enable timetable
+// lines to be skipped if:
 //     iso.earliest_departure [departure_station [i]] > departure_time [i]
-// It is nevertheless important to connect all possible transfers, because they
-// may represent later initial departure times with subsequent connecting
-// services.
 void iso::fill_one_transfer (
-        const size_t &departure_station,
+        const size_t &trip_id,
         const size_t &arrival_station,
         const int &arrival_time,
         const size_t &trans_dest,
         const int &trans_duration,
-        const bool &minimise_transfers,
         Iso &iso)
 {
     const int trans_time = arrival_time + trans_duration;
 
-    // Bunch of AND conditions separated for easy reading.
-    bool insert_transfer = (trans_dest != departure_station); // can happen
-    //if (insert_transfer)
-    //    insert_transfer = iso::is_transfer_connected (
-    //            iso, trans_dest, trans_time);
-    if (insert_transfer)
-        insert_transfer = iso::is_transfer_in_isochrone (
-                iso, arrival_station, trans_time);
-
-    if (!insert_transfer)
-        return;
-
-    if (iso.earliest_departure [trans_dest] == INFINITE_INT ||
-            trans_time < iso.earliest_departure [trans_dest])
-        iso.earliest_departure [trans_dest] = trans_time;
-
-    const size_t s = iso.extend (trans_dest) - 1;
-
-    iso.connections [trans_dest].convec [s].is_transfer = true;
-    iso.connections [trans_dest].convec [s].prev_stn = arrival_station;
-    iso.connections [trans_dest].convec [s].departure_time = arrival_time;
-    iso.connections [trans_dest].convec [s].arrival_time = trans_time;
-
-    // Find the latest initial departure time for all services
-    // connecting to arrival station:
-    int latest_initial = -1L;
-    int ntransfers = INFINITE_INT;
-
-    for (auto st: iso.connections [arrival_station].convec)
+    for (size_t j = 0; j < iso.trip_size (trip_id); j++)
     {
-        bool fill_here = (st.arrival_time <= arrival_time) &&
-            ((arrival_time - st.initial_depart) <= iso.get_max_traveltime ());
+        Iso::OnTrip &ot = iso.on_trip (trip_id, j);
+        if ((trans_time - ot.initial_depart) > iso.get_max_traveltime ())
+            continue;
 
-        if (fill_here)
+        Iso::OneCon label;
+        label.arrival_time = trans_time;
+        label.ntransfers = ot.ntransfers;
+        label.initial_depart = ot.initial_depart;
+        if (iso.paths)
         {
-            bool update = iso::update_best_connection (
-                    st.initial_depart,
-                    latest_initial,
-                    st.ntransfers,
-                    ntransfers,
-                    minimise_transfers);
-
-            if (update)
-                update = (trans_time - st.initial_depart) < iso.get_max_traveltime();
-
-            if (update)
-            {
-                ntransfers = st.ntransfers;
-                latest_initial = st.initial_depart;
-            }
+            if (ot.leg < 0)
+                ot.leg = iso.paths->add (ot.parent, trip_id, ot.board_station,
+                        ot.board_time, arrival_station, arrival_time);
+            label.leg = iso.paths->add (ot.leg, INFINITE_INT,
+                    arrival_station, arrival_time, trans_dest, trans_time);
         }
-    }
 
-    if (ntransfers < INFINITE_INT)
-    {
-        iso.connections [trans_dest].convec [s].ntransfers = ntransfers + 1;
-        iso.connections [trans_dest].convec [s].initial_depart = latest_initial;
-    }
+        iso.touch (trans_dest);
+        if (iso.earliest_departure [trans_dest] > trans_time)
+            iso.earliest_departure [trans_dest] = trans_time;
 
-    DEBUGMSGTR("---TR: (" << arrival_station << " -> " <<
-            trans_dest << "), time(" <<
-            arrival_time << " -> " <<
-            trans_time << ") - " << latest_initial <<
-            " = " << trans_time - latest_initial <<
-            "s with " << ntransfers << " transfers" <<
-            "; INITIAL DEPART = " << latest_initial,
-            trans_dest, arrival_time);
-}
+        const bool inserted = iso::insert_label (iso, trans_dest, label);
+        if (iso.paths && !inserted)
+            iso.paths->pop ();
 
-int iso::find_actual_end_time (
-        const size_t &n,
-        const std::vector <int> &departure_time,
-        const std::vector <size_t> &departure_station,
-        const std::unordered_set <size_t> &start_stations_set,
-        const int &start_time,
-        const int &end_time)
-{
-    // Find time of first departing service from one of the start_stations
-    bool found = false;
-    int actual_start_time = INFINITE_INT;
-    int actual_end_time = INFINITE_INT;
-    for (size_t i = 0; i < n; i++)
-    {
-        if (departure_time [i] < start_time)
-            continue; // # nocov - these lines already removed in R fn.
-
-        // add all departures from start_stations_set:
-        if (start_stations_set.find (departure_station [i]) !=
-                start_stations_set.end ())
+        if (inserted)
         {
-            actual_start_time = departure_time [i];
-            found = true;
+            DEBUGMSGTR("---TR: (" << arrival_station << " -> " <<
+                    trans_dest << "), time(" <<
+                    arrival_time << " -> " <<
+                    trans_time << ") - " << ot.initial_depart <<
+                    " = " << trans_time - ot.initial_depart <<
+                    "s with " << ot.ntransfers << " transfers",
+                    trans_dest, arrival_time);
         }
-        if (found)
-            break;
     }
-    // Scan up until twice the isochrone duration from the actual start time:
-    if (actual_start_time < INFINITE_INT)
-        actual_end_time = 2 * (end_time - start_time) + actual_start_time;
-
-    return (actual_end_time);
 }
 
-void iso::make_transfer_map (
-    std::unordered_map <size_t, std::unordered_map <size_t, int> > &transfer_map,
-    const std::vector <size_t> &trans_from,
-    const std::vector <size_t> &trans_to,
-    const std::vector <int> &trans_time
-        )
+// Labels arriving at or before departure_time can all board any subsequent
+// departure, so are compared only on initial departure times and numbers of
+// transfers, and dominated ones removed. Because connections are scanned in
+// order of departure time, labels removed here could never be used again.
+// Returns the number of labels which may board a departure at that time,
+// which are the first labels for that station.
+size_t iso::settle_labels (
+        Iso &iso,
+        const size_t &stn,
+        const int &departure_time)
 {
-    for (size_t i = 0; i < static_cast <size_t> (trans_from.size ()); i++)
+    const auto labels = iso.cons (stn);
+    const size_t nboard = static_cast <size_t> (std::upper_bound (
+                labels.begin (), labels.end (), departure_time,
+                [] (const int t, const Iso::OneCon &con) {
+                    return t < con.arrival_time;
+                }) - labels.begin ());
+
+    // Labels are compared with those retained so far, [0, n), and those not
+    // yet considered, (j, nboard). Dominance is transitive, so this suffices.
+    size_t n = 0;
+    for (size_t j = 0; j < nboard; j++)
     {
-        if (trans_from [i] != trans_to [i])
+        const Iso::OneCon &lj = iso.con (stn, j);
+        bool dominated = false;
+        for (size_t k = 0; k < nboard && !dominated; k++)
         {
-            std::unordered_map <size_t, int> transfer_pair; // station, time
-            if (transfer_map.find (trans_from [i]) == transfer_map.end ())
-            {
-                transfer_pair.clear ();
-                transfer_pair.emplace (trans_to [i], trans_time [i]);
-                transfer_map.emplace (trans_from [i], transfer_pair);
-            } else
-            {
-                transfer_pair = transfer_map.at (trans_from [i]);
-                transfer_pair.emplace (trans_to [i], trans_time [i]);
-                transfer_map [trans_from [i]] = transfer_pair;
-            }
+            if (k == n)
+                k = j + 1;
+            if (k >= nboard)
+                break;
+            const Iso::OneCon &lk = iso.con (stn, k);
+            if (lk.initial_depart < lj.initial_depart ||
+                    lk.ntransfers > lj.ntransfers)
+                continue;
+            // Of equal labels, retain only the first:
+            dominated = lk.initial_depart > lj.initial_depart ||
+                lk.ntransfers < lj.ntransfers || k < j;
         }
+        if (!dominated)
+            iso.con (stn, n++) = iso.con (stn, j);
     }
-}
-
-
-void iso::trace_back_one_stn (
-        const Iso & iso,
-        BackTrace & backtrace,
-        const size_t & end_stn,
-        const bool &minimise_transfers
-        )
-{
-    size_t stn = end_stn;
-
-    size_t prev_index = iso::trace_back_first (iso, stn);
-
-    int arrival_time = iso.connections [stn].convec [prev_index].arrival_time;
-    int departure_time = iso.connections [stn].convec [prev_index].departure_time;
-    size_t departure_stn = iso.connections [stn].convec [prev_index].prev_stn;
-    size_t this_trip = iso.connections [stn].convec [prev_index].trip;
-
-    backtrace.end_station.push_back (stn);
-    backtrace.trip.push_back (this_trip);
-    backtrace.end_times.push_back (arrival_time);
-
-    size_t temp = 0;
 
-    while (prev_index < INFINITE_INT)
+    if (n < nboard)
     {
-        stn = iso.connections [stn].convec [prev_index].prev_stn;
+        const size_t nlabels = iso.size (stn);
+        for (size_t j = nboard; j < nlabels; j++)
+            iso.con (stn, n + j - nboard) = iso.con (stn, j);
+        iso.truncate (stn, n + nlabels - nboard);
+    }
 
-        prev_index = iso::trace_back_prev_index (iso, stn, departure_time, this_trip,
-                minimise_transfers);
+    return n;
+}
 
-        backtrace.trip.push_back (this_trip);
-        backtrace.end_times.push_back (departure_time);
+// Insert a label in order of arrival time, unless it is dominated by an
+// existing label, and remove any existing labels which it dominates. Returns
+// true if the label was inserted.
+bool iso::insert_label (
+        Iso &iso,
+        const size_t &stn,
+        const Iso::OneCon &label)
+{
+    const size_t nlabels = iso.size (stn);
 
-        if (prev_index < INFINITE_INT)
-        {
-            this_trip = iso.connections [stn].convec [prev_index].trip;
-            arrival_time = iso.connections [stn].convec [prev_index].arrival_time;
+    size_t pos = 0;
+    for (; pos < nlabels; pos++)
+    {
+        const Iso::OneCon &st = iso.con (stn, pos);
+        if (st.arrival_time > label.arrival_time)
+            break;
+        if (st.initial_depart >= label.initial_depart &&
+                st.ntransfers <= label.ntransfers)
+            return false;
+    }
 
-            backtrace.end_station.push_back (stn);
+    // Remove later labels dominated by the new one:
+    size_t n = pos;
+    for (size_t j = pos; j < nlabels; j++)
+    {
+        const Iso::OneCon &st = iso.con (stn, j);
+        if (st.initial_depart > label.initial_depart ||
+                st.ntransfers < label.ntransfers)
+            iso.con (stn, n++) = st;
+    }
 
-            departure_time = iso.connections [stn].convec [prev_index].departure_time;
-            departure_stn = iso.connections [stn].convec [prev_index].prev_stn;
-        }
+    if (n == nlabels)
+        iso.extend (stn);
+    else
+        iso.truncate (stn, n + 1);
 
+    for (size_t j = n; j > pos; j--)
+        iso.con (stn, j) = iso.con (stn, j - 1);
+    iso.con (stn, pos) = label;
 
-        temp++;
-        if (temp > iso.is_end_stn.size ())
-            Rcpp::stop ("backtrace has no end");
-    }
-    backtrace.end_station.push_back (departure_stn);
+    return true;
+}
 
-    std::reverse (backtrace.end_station.begin (), backtrace.end_station.end ());
-    std::reverse (backtrace.end_times.begin (), backtrace.end_times.end ());
-    std::reverse (backtrace.trip.begin (), backtrace.trip.end ());
+// Add one way of riding a trip, unless it is dominated by an existing one, and
+// remove any existing ways which it dominates.
+void iso::board_trip (
+        Iso &iso,
+        const size_t &trip_id,
+        const int &initial_depart,
+        const int &ntransfers,
+        const int &parent,
+        const size_t &board_station,
+        const int &board_time)
+{
+    const size_t ntrip = iso.trip_size (trip_id);
 
-    // trips can end with transfers which have to be removed here
-    while (backtrace.trip.back () == INFINITE_INT)
+    size_t n = 0;
+    for (size_t j = 0; j < ntrip; j++)
     {
-        backtrace.end_station.resize (backtrace.end_station.size () - 1);
-        backtrace.end_times.resize (backtrace.end_times.size () - 1);
-        backtrace.trip.resize (backtrace.trip.size () - 1);
+        const Iso::OnTrip ot = iso.on_trip (trip_id, j);
+        if (ot.initial_depart >= initial_depart && ot.ntransfers <= ntransfers)
+            return;
+        if (ot.initial_depart > initial_depart || ot.ntransfers < ntransfers)
+            iso.on_trip (trip_id, n++) = ot;
     }
+
+    if (n == ntrip)
+        iso.extend_trip (trip_id);
+    else
+        iso.truncate_trip (trip_id, n + 1);
+
+    Iso::OnTrip &ot = iso.on_trip (trip_id, n);
+    ot.initial_depart = initial_depart;
+    ot.ntransfers = ntransfers;
+    ot.parent = parent;
+    ot.board_station = static_cast <int> (board_station);
+    ot.board_time = board_time;
 }
 
-// Trace back first connection from terminal station, which is simply the first
-// equal shortest connection to that stn
-size_t iso::trace_back_first (
-        const Iso & iso,
-        const size_t & stn
-        )
+// Update the best travel time to one station for a connection arriving there,
+// and return true if updated. Transfers between stations are not considered to
+// reach a station.
+bool iso::update_traveltime (
+        Iso &iso,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_depart,
+        const int &ntransfers,
+        const bool &minimise_transfers)
 {
-    size_t prev_index = INFINITE_INT;
-    int shortest_journey = INFINITE_INT;
+    const int duration = arrival_time - initial_depart;
 
-    size_t index = 0;
-    for (auto st: iso.connections [stn].convec)
+    bool update = false;
+    if (minimise_transfers)
     {
-        const int journey = st.arrival_time - st.initial_depart;
-
-        if (journey < shortest_journey)
-        {
-            shortest_journey = journey;
-            prev_index = index;
-        }
+        update = ntransfers < iso.ntransfers [stn] ||
+            (ntransfers == iso.ntransfers [stn] &&
+             duration < iso.duration [stn]);
+    } else
+    {
+        update = duration < iso.duration [stn] ||
+            (duration == iso.duration [stn] &&
+             ntransfers < iso.ntransfers [stn]);
+    }
 
-        index++;
+    if (update)
+    {
+        iso.start_time [stn] = initial_depart;
+        iso.duration [stn] = duration;
+        iso.ntransfers [stn] = ntransfers;
     }
 
-    return (prev_index);
+    return update;
 }
 
-size_t iso::trace_back_prev_index (
-        const Iso & iso,
-        const size_t & stn,
-        const int & departure_time,
-        const size_t & trip_id,
-        const bool &minimise_transfers
-        )
+// Add one (arrival_time, initial_depart) pair to the profile of a station,
+// unless dominated by an existing pair. All subsequent arrivals will be at or
+// after scan_time, so pairs arriving prior to that are first flushed to the
+// histogram for that station.
+void iso::update_profile (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_depart,
+        const int &scan_time)
 {
-    size_t prev_index = INFINITE_INT;
-    int ntransfers = INFINITE_INT;
-    int latest_initial = -1l;
+    iso::flush_profile (profile, stn, scan_time);
 
-    bool same_trip = false;
+    // Dominated by a pair already added to the histogram:
+    if (initial_depart <= profile.last_initial [stn])
+        return;
 
-    size_t index = 0;
-    for (auto st: iso.connections [stn].convec)
-    {
-        if (st.arrival_time <= departure_time)
-        {
-            bool update = same_trip = (st.trip == trip_id);
-            if (!update)
-            {
-                update = iso::update_best_connection (
-                        st.initial_depart,
-                        latest_initial,
-                        st.ntransfers,
-                        ntransfers,
-                        minimise_transfers);
-            }
+    const size_t npairs = profile.pairs.size (stn);
 
-            if (update)
-            {
-                prev_index = index;
-                latest_initial = st.initial_depart;
-                ntransfers = st.ntransfers;
-            }
-        }
-        if (same_trip)
+    size_t pos = 0;
+    for (; pos < npairs; pos++)
+    {
+        const IsoProfile::Pair &p = profile.pairs.at (stn, pos);
+        if (p.arrival_time > arrival_time)
             break;
+        if (p.initial_depart >= initial_depart)
+            return;
+    }
 
-        index++;
+    size_t n = pos;
+    for (size_t j = pos; j < npairs; j++)
+    {
+        const IsoProfile::Pair &p = profile.pairs.at (stn, j);
+        if (p.initial_depart > initial_depart)
+            profile.pairs.at (stn, n++) = p;
     }
 
-    return (prev_index);
+    if (n == npairs)
+        profile.pairs.extend (stn);
+    else
+        profile.pairs.truncate (stn, n + 1);
+
+    for (size_t j = n; j > pos; j--)
+        profile.pairs.at (stn, j) = profile.pairs.at (stn, j - 1);
+    profile.pairs.at (stn, pos).arrival_time = arrival_time;
+    profile.pairs.at (stn, pos).initial_depart = initial_depart;
 }
 
-bool iso::update_best_connection (
-        const int & this_initial,
-        const int & latest_initial,
-        const int & this_transfers,
-        const int & min_transfers,
-        const bool &minimise_transfers)
+// Pairs are ordered by arrival time, so those which arrive prior to scan_time
+// are the first ones. Each of these gives the earliest arrival for all
+// departures after the initial departure of the previous pair, up to and
+// including its own initial departure.
+void iso::flush_profile (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &scan_time)
 {
-    bool update = false;
+    const size_t npairs = profile.pairs.size (stn);
 
-    if (minimise_transfers)
+    size_t nfinal = 0;
+    while (nfinal < npairs &&
+            profile.pairs.at (stn, nfinal).arrival_time < scan_time)
     {
+        const IsoProfile::Pair p = profile.pairs.at (stn, nfinal++);
+        iso::add_profile_segment (profile, stn, p.arrival_time,
+                profile.last_initial [stn] + 1, p.initial_depart);
+        profile.last_initial [stn] = p.initial_depart;
+    }
+
+    if (nfinal == 0)
+        return;
 
-        update = (this_transfers < min_transfers);
-        if (!update && (this_transfers == min_transfers))
-            update = (this_initial > latest_initial);
+    for (size_t j = nfinal; j < npairs; j++)
+        profile.pairs.at (stn, j - nfinal) = profile.pairs.at (stn, j);
+    profile.pairs.truncate (stn, npairs - nfinal);
+}
 
-    } else {
+// Add travel times to the histogram of one station for all departures between
+// initial_min and initial_max which arrive at arrival_time, and for which
+// travel times are within max_traveltime. Departures are at every bin_width
+// from start_time_min, so successive departures fall in successive bins.
+void iso::add_profile_segment (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_min,
+        const int &initial_max)
+{
+    const int lower = std::max (initial_min,
+            arrival_time - profile.max_traveltime);
+    if (initial_max < lower)
+        return;
 
-        update = (this_initial > latest_initial && this_transfers <= min_transfers);
-        if (!update && this_transfers < min_transfers)
-            update = (this_initial == latest_initial);
+    const int bw = profile.bin_width;
+    const int first = std::max (0,
+            (lower - profile.start_time_min + bw - 1) / bw);
+    const int last = std::min (profile.ndepartures () - 1,
+            (initial_max - profile.start_time_min) / bw);
+    if (last < first)
+        return;
 
+    if (profile.hist_offset [stn] == INFINITE_INT)
+    {
+        profile.hist_offset [stn] = profile.hist.size ();
+        profile.hist.resize (profile.hist.size () +
+                static_cast <size_t> (profile.nbins), 0L);
     }
 
-    return update;
+    for (int i = first; i <= last; i++)
+    {
+        const int traveltime = arrival_time -
+            (profile.start_time_min + i * bw);
+        profile.hist [profile.hist_offset [stn] +
+            static_cast <size_t> (traveltime / bw)]++;
+    }
 }
 
-
-bool iso::is_transfer_connected (
-        const Iso & iso,
-        const size_t & station,
-        const int & transfer_time
-        )
+// Travel time at a given percentile of all departures in the window, with
+// departures which do not reach the station considered to be infinitely long.
+// Values are linearly interpolated within histogram bins.
+int iso::profile_percentile (
+        const IsoProfile &profile,
+        const size_t &stn,
+        const double &percentile)
 {
-    const bool res = (transfer_time <= iso.earliest_departure [station]);
+    if (profile.hist_offset [stn] == INFINITE_INT)
+        return INFINITE_INT;
 
-    return res;
+    const int rank = std::max (1, static_cast <int> (
+                std::ceil (percentile * profile.ndepartures ())));
+
+    int cumsum = 0;
+    for (int b = 0; b < profile.nbins; b++)
+    {
+        const int count = profile.hist [profile.hist_offset [stn] +
+            static_cast <size_t> (b)];
+        if (cumsum + count >= rank)
+            return b * profile.bin_width +
+                (profile.bin_width * (2 * (rank - cumsum) - 1)) / (2 * count);
+        cumsum += count;
+    }
+
+    return INFINITE_INT;
 }
 
-// Return a dummy value of 0 for stations which have not yet been reached, so
-// they will be connected by transfer no matter what; otherwise return actual
-// minimal journey time to that station.
-bool iso::is_transfer_in_isochrone (
-        Iso & iso,
-        const size_t & station,
-        const int & transfer_time
-        )
+// Index one beyond the last connection which can be part of any journey from
+// start_time_max within max_traveltime. Connections depart before they arrive,
+// so none departing after that horizon can arrive in time.
+size_t iso::end_connection (
+        const NetworkArray <int> &departure_time,
+        const int &start_time_max,
+        const int &max_traveltime)
 {
-    int journey = 0L;
-    if (iso.earliest_departure [station] < INFINITE_INT)
-        journey = transfer_time - iso.earliest_departure [station];
+    const int horizon = (start_time_max > INFINITE_INT - max_traveltime) ?
+        INFINITE_INT : start_time_max + max_traveltime;
 
-    return (journey <= iso.get_max_traveltime ());
+    return static_cast <size_t> (std::upper_bound (departure_time.begin (),
+                departure_time.end (), horizon) - departure_time.begin ());
 }
 
 bool iso::is_start_stn (
@@ -639,24 +571,3 @@ bool iso::is_start_stn (
 {
     return start_stations_set.find (stn) != start_stations_set.end ();
 }
-
-// Is the arrival station already listed as a previous station of departure
-// station?
-//
-// Example: A previous connection A -> B has already been read.
-// On reading B -> A, first check that A (arrival_station) is not already a
-// prior station of B (departure_station), so check over all connections for
-// departure station (= B) to check that none of the listed "departure_station"
-// -- NOT arrival_station -- values are A.
-bool iso::arrival_already_visited (
-        const Iso & iso,
-        const size_t & departure_station,
-        const size_t & arrival_station)
-{
-    bool check = false;
-    for (auto st: iso.connections [departure_station].convec)
-        if (st.prev_stn == arrival_station)
-            check = true;
-
-    return check;
-}
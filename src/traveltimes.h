@@ -45,67 +45,343 @@
 #endif
 // ----- debugging output END -----
 
-class Iso
+// Labels are held in a single pool, within which each station (or trip) has a
+// contiguous slab. Slabs which fill up are moved to the end of the pool with
+// twice their previous capacity, so stations do not each own
+// separately-allocated vectors, and all labels can be released at once by
+// clearing the pool.
+template <typename T>
+class SlabPool
 {
     private:
 
-        int max_traveltime;
+        struct Slab {
+            size_t offset = 0, size = 0, capacity = 0;
+        };
+
+        std::vector <T> pool;
+        std::vector <Slab> slabs;
+        // Slabs modified since last reset:
+        std::vector <size_t> touched;
+        std::vector <bool> is_touched;
+
+    public:
+
+        // Range of elements of one slab, for range-based for loops:
+        struct Span {
+            const T *first, *last;
+            const T *begin () const { return first; }
+            const T *end () const { return last; }
+        };
+
+        SlabPool (const size_t n) {
+            slabs.resize (n);
+            is_touched.resize (n, false);
+        }
+
+        size_t nslabs () const {
+            return slabs.size ();
+        }
+
+        size_t size (const size_t n) const {
+            return slabs [n].size;
+        }
+
+        Span span (const size_t n) const {
+            const T *first = pool.data () + slabs [n].offset;
+            return Span {first, first + slabs [n].size};
+        }
+
+        T &at (const size_t n, const size_t i) {
+            return pool [slabs [n].offset + i];
+        }
+
+        const T &at (const size_t n, const size_t i) const {
+            return pool [slabs [n].offset + i];
+        }
 
+        // Add one default-initialised element to slab n, and return the new
+        // size of that slab.
+        size_t extend (const size_t n) {
+            if (!is_touched [n]) {
+                is_touched [n] = true;
+                touched.push_back (n);
+            }
+
+            Slab &slab = slabs [n];
+            if (slab.size == slab.capacity) {
+                const size_t offset = pool.size ();
+                slab.capacity = std::max <size_t> (4L, 2L * slab.capacity);
+                pool.resize (offset + slab.capacity);
+                std::copy (pool.begin () + slab.offset,
+                        pool.begin () + slab.offset + slab.size,
+                        pool.begin () + offset);
+                slab.offset = offset;
+            }
+
+            pool [slab.offset + slab.size] = T ();
+
+            return ++slab.size;
+        }
+
+        // Drop all but the first 'size' elements of slab n.
+        void truncate (const size_t n, const size_t size) {
+            slabs [n].size = std::min (slabs [n].size, size);
+        }
+
+        // Restore initial state, at a cost proportional only to the number of
+        // slabs modified since the previous reset.
+        void reset () {
+            for (auto n: touched) {
+                slabs [n] = Slab ();
+                is_touched [n] = false;
+            }
+            touched.clear ();
+            pool.clear ();
+        }
+};
+
+// Distributions of travel times to each station for departures at each minute
+// of a window. The earliest arrival at each station for departures at or after
+// any time is given by a profile of (arrival_time, initial_depart) pairs, in
+// which both increase together. Profiles are only held for arrivals which
+// might still be dominated as the scan proceeds; earlier pairs are final, and
+// are immediately added to histograms of travel times at a resolution of
+// bin_width. Memory is therefore independent of the length of the window.
+struct IsoProfile
+{
+    struct Pair {
+        int arrival_time = INFINITE_INT,
+            initial_depart = INFINITE_INT;
+    };
+
+    int start_time_min, start_time_max, max_traveltime, bin_width, nbins;
+
+    SlabPool <Pair> pairs;
+    // Initial departure of latest pair added to histogram for each station:
+    std::vector <int> last_initial;
+    // Offsets of histograms for each station, which are only allocated for
+    // stations which are reached:
+    std::vector <size_t> hist_offset;
+    std::vector <int> hist;
+
+    IsoProfile (const size_t n,
+            const int start_time_min_in,
+            const int start_time_max_in,
+            const int max_traveltime_in,
+            const int bin_width_in) :
+        start_time_min (start_time_min_in),
+        start_time_max (start_time_max_in),
+        max_traveltime (max_traveltime_in),
+        bin_width (bin_width_in),
+        nbins (max_traveltime_in / bin_width_in + 1),
+        pairs (n) {
+
+        last_initial.resize (n, start_time_min - 1);
+        hist_offset.resize (n, INFINITE_INT);
+    }
+
+    // Number of departures in the window, one every bin_width:
+    int ndepartures () const {
+        return (start_time_max - start_time_min) / bin_width + 1;
+    }
+};
+
+// Journeys to all stations held as a single tree of legs, each of which is
+// either part of one trip, or a transfer with a trip of INFINITE_INT. Each leg
+// departs from the arrival station of its parent leg, or from a start station
+// for legs with no parent (parent = -1). Legs are only ever appended, so
+// parents always precede their children, and journeys which share initial
+// legs share the nodes for those legs. Legs are held in flat vectors, rather
+// than vectors for each station, and only those of non-dominated labels are
+// retained.
+struct IsoPaths
+{
+    std::vector <int> parent, trip,
+        departure_station, departure_time,
+        arrival_station, arrival_time;
+    // Final leg of the best journey to each station, or -1:
+    std::vector <int> best;
+
+    IsoPaths (const size_t n) {
+        best.resize (n, -1L);
+    }
+
+    size_t size () const {
+        return parent.size ();
+    }
+
+    int add (const int parent_in,
+            const size_t trip_in,
+            const size_t departure_station_in,
+            const int departure_time_in,
+            const size_t arrival_station_in,
+            const int arrival_time_in) {
+        parent.push_back (parent_in);
+        trip.push_back (static_cast <int> (trip_in));
+        departure_station.push_back (static_cast <int> (departure_station_in));
+        departure_time.push_back (departure_time_in);
+        arrival_station.push_back (static_cast <int> (arrival_station_in));
+        arrival_time.push_back (arrival_time_in);
+        return static_cast <int> (parent.size ()) - 1L;
+    }
+
+    // Remove the last leg, which must not be referenced by any other.
+    void pop () {
+        parent.pop_back ();
+        trip.pop_back ();
+        departure_station.pop_back ();
+        departure_time.pop_back ();
+        arrival_station.pop_back ();
+        arrival_time.pop_back ();
+    }
+};
+
+// Station labels are kept free of dominated entries, and ordered by arrival
+// time. A label dominates another if it arrives no later, with an initial
+// departure no earlier, and no more transfers. Labels for each trip hold
+// the non-dominated (initial_depart, ntransfers) pairs with which the trip
+// may currently be ridden. Best values for each station are recorded as
+// labels are created, so remain even when labels are later dominated.
+class Iso
+{
+    public:
+
+        // Labels and trips only refer to the legs of an optional IsoPaths
+        // object, with values of -1 when paths are not recorded.
         struct OneCon {
-            bool is_transfer = false;
-            size_t prev_stn,
-                   trip;
-            int departure_time,
-                arrival_time,
-                ntransfers,
-                initial_depart;
+            int arrival_time = INFINITE_INT,
+                ntransfers = 0L,
+                initial_depart = INFINITE_INT,
+                leg = -1L;
         };
 
-        struct ConVec {
-            std::vector <OneCon> convec;
+        // 'parent' is the leg leading to the station at which the trip was
+        // boarded, and 'leg' the leg riding the trip to the station of the
+        // current connection.
+        struct OnTrip {
+            int initial_depart = INFINITE_INT,
+                ntransfers = 0L,
+                parent = -1L,
+                leg = -1L,
+                board_station = 0L,
+                board_time = INFINITE_INT;
         };
 
-    public:
+    private:
 
-        std::vector <bool> is_end_stn;
-        std::vector <int> earliest_departure;
+        int max_traveltime;
 
-        std::vector <ConVec> connections;
+        SlabPool <OneCon> labels;
+        SlabPool <OnTrip> trips;
+
+        // Stations modified since last reset:
+        std::vector <size_t> touched;
+        std::vector <bool> is_touched;
+
+    public:
 
-        Iso (const size_t n, const int max_traveltime_in) {
+        std::vector <int> earliest_departure;
+        // Best travel times to each station:
+        std::vector <int> start_time, duration, ntransfers;
+        // Optional distributions of travel times, and journey paths, neither
+        // of which are owned by this object:
+        IsoProfile *profile = nullptr;
+        IsoPaths *paths = nullptr;
+        // Trips active on the day of the scan; see TripServices:
+        const uint64_t *trip_active = nullptr;
+
+        Iso (const size_t n, const size_t ntrips, const int max_traveltime_in) :
+            labels (n), trips (ntrips) {
 
             max_traveltime = max_traveltime_in;
 
-            is_end_stn.resize (n, false);
             earliest_departure.resize (n, INFINITE_INT);
-            connections.resize (n);
+            start_time.resize (n, INFINITE_INT);
+            duration.resize (n, INFINITE_INT);
+            ntransfers.resize (n, INFINITE_INT);
+            is_touched.resize (n, false);
+        }
+
+        size_t nstations () const {
+            return labels.nslabs ();
+        }
+
+        // All stations reached by any label, in the order first reached:
+        const std::vector <size_t> &touched_stations () const {
+            return touched;
+        }
+
+        // Must be called before modifying any values for station n.
+        void touch (const size_t n) {
+            if (!is_touched [n]) {
+                is_touched [n] = true;
+                touched.push_back (n);
+            }
+        }
+
+        size_t size (const size_t n) const {
+            return labels.size (n);
+        }
+
+        SlabPool <OneCon>::Span cons (const size_t n) const {
+            return labels.span (n);
+        }
+
+        OneCon &con (const size_t n, const size_t i) {
+            return labels.at (n, i);
         }
 
+        const OneCon &con (const size_t n, const size_t i) const {
+            return labels.at (n, i);
+        }
+
+        // Add one connection to station n, and return the new number of
+        // connections for that station.
         size_t extend (const size_t n) {
-            const size_t s = connections [n].convec.size () + 1L;
+            touch (n);
+            return labels.extend (n);
+        }
 
-            connections [n].convec.resize (s);
+        void truncate (const size_t n, const size_t size) {
+            labels.truncate (n, size);
+        }
 
-            connections [n].convec.back ().prev_stn = INFINITE_INT;
-            connections [n].convec.back ().departure_time = INFINITE_INT;
-            connections [n].convec.back ().arrival_time = INFINITE_INT;
-            connections [n].convec.back ().trip = INFINITE_INT;
-            connections [n].convec.back ().ntransfers = 0L;
-            connections [n].convec.back ().initial_depart = INFINITE_INT;
+        size_t trip_size (const size_t t) const {
+            return trips.size (t);
+        }
 
-            return s;
+        OnTrip &on_trip (const size_t t, const size_t i) {
+            return trips.at (t, i);
         }
 
-        int get_max_traveltime () {
-            return max_traveltime;
+        size_t extend_trip (const size_t t) {
+            return trips.extend (t);
         }
 
-};
+        void truncate_trip (const size_t t, const size_t size) {
+            trips.truncate (t, size);
+        }
+
+        // Restore initial state for a new query, at a cost proportional only
+        // to the number of stations reached by the previous query.
+        void reset () {
+            for (auto n: touched) {
+                earliest_departure [n] = INFINITE_INT;
+                start_time [n] = INFINITE_INT;
+                duration [n] = INFINITE_INT;
+                ntransfers [n] = INFINITE_INT;
+                is_touched [n] = false;
+            }
+            touched.clear ();
+            labels.reset ();
+            trips.reset ();
+        }
+
+        int get_max_traveltime () const {
+            return max_traveltime;
+        }
 
-struct BackTrace
-{
-    std::vector <size_t> trip, end_station;
-    std::vector <int> end_times;
 };
 
 namespace iso {
@@ -124,104 +400,114 @@ void trace_forward_traveltimes (
         Iso & iso,
         const int & start_time_min,
         const int & start_time_max,
-        const std::vector <size_t> & departure_station,
-        const std::vector <size_t> & arrival_station,
-        const std::vector <size_t> & trip_id,
-        const std::vector <int> & departure_time,
-        const std::vector <int> & arrival_time,
-        const std::unordered_map <size_t, std::unordered_map <size_t, int> > & transfer_map,
+        const CSA_Inputs & csa_in,
         const std::unordered_set <size_t> & start_stations_set,
         const bool & minimise_transfers);
 
 void fill_one_transfer (
-        const size_t &departure_station,
+        const size_t &trip_id,
         const size_t &arrival_station,
         const int &arrival_time,
         const size_t &trans_dest,
         const int &trans_duration,
-        const bool &minimise_transfers,
         Iso &iso);
 
-int find_actual_end_time (
-        const size_t &n,
-        const std::vector <int> &departure_time,
-        const std::vector <size_t> &departure_station,
-        const std::unordered_set <size_t> &start_stations_set,
-        const int &start_time,
-        const int &end_time
-        );
+size_t settle_labels (
+        Iso &iso,
+        const size_t &stn,
+        const int &departure_time);
 
-void make_transfer_map (
-    std::unordered_map <size_t, std::unordered_map <size_t, int> > &transfer_map,
-    const std::vector <size_t> &trans_from,
-    const std::vector <size_t> &trans_to,
-    const std::vector <int> &trans_time
-        );
+bool insert_label (
+        Iso &iso,
+        const size_t &stn,
+        const Iso::OneCon &label);
 
-size_t trace_back_first (
-        const Iso & iso,
-        const size_t & stn
-        );
-
-size_t trace_back_prev_index (
-        const Iso & iso,
-        const size_t & stn,
-        const int & departure_time,
-        const size_t & trip_id,
-        const bool &minimise_transfers
-        );
-
-bool update_best_connection (
-        const int & this_initial,
-        const int & latest_initial,
-        const int & this_transfers,
-        const int & min_transfers,
-        const bool &minimise_transfers
-        );
-
-bool is_transfer_in_isochrone (
-        Iso & iso,
-        const size_t & station,
-        const int & transfer_time
-        );
+void board_trip (
+        Iso &iso,
+        const size_t &trip_id,
+        const int &initial_depart,
+        const int &ntransfers,
+        const int &parent,
+        const size_t &board_station,
+        const int &board_time);
+
+bool update_traveltime (
+        Iso &iso,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_depart,
+        const int &ntransfers,
+        const bool &minimise_transfers);
 
-bool is_transfer_connected (
-        const Iso & iso,
-        const size_t & station,
-        const int & transfer_time
-        );
+size_t end_connection (
+        const NetworkArray <int> &departure_time,
+        const int &start_time_max,
+        const int &max_traveltime);
 
 bool is_start_stn (
     const std::unordered_set <size_t> &start_stations_set,
     const size_t &stn);
 
-bool arrival_already_visited (
-        const Iso & iso,
-        const size_t & departure_station,
-        const size_t & arrival_station);
+void update_profile (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_depart,
+        const int &scan_time);
+
+void flush_profile (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &scan_time);
 
-// The only Rcpp function:
+void add_profile_segment (
+        IsoProfile &profile,
+        const size_t &stn,
+        const int &arrival_time,
+        const int &initial_min,
+        const int &initial_max);
+
+int profile_percentile (
+        const IsoProfile &profile,
+        const size_t &stn,
+        const double &percentile);
+
+// The only Rcpp functions:
 Rcpp::IntegerMatrix trace_back_traveltimes (
-        const Iso & iso,
-        const bool &minimise_transfers
+        const Iso & iso
         );
 
-// but most work done in this pure C++ fn:
-void trace_back_one_stn (
-        const Iso & iso,
-        BackTrace & backtrace,
-        const size_t & end_stn,
-        const bool &minimise_transfers
+Rcpp::List trace_back_paths (
+        const IsoPaths & paths,
+        const Rcpp::IntegerMatrix & traveltimes
         );
 
-
 } // end namespace iso
 
-Rcpp::IntegerMatrix rcpp_traveltimes (Rcpp::DataFrame timetable,
-        Rcpp::DataFrame transfers,
-        const size_t nstations,
+Rcpp::IntegerMatrix rcpp_traveltimes (SEXP engine,
+        const std::vector <size_t> start_stations,
+        const int start_time_min,
+        const int start_time_max,
+        const bool minimise_transfers,
+        const int max_traveltime,
+        const bool return_paths,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+Rcpp::IntegerMatrix rcpp_traveltimes_percentiles (SEXP engine,
         const std::vector <size_t> start_stations,
         const int start_time_min,
         const int start_time_max,
+        const int max_traveltime,
+        const std::vector <double> percentiles,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);
+
+Rcpp::List rcpp_traveltimes_matrix (SEXP engine,
+        Rcpp::List start_stations,
+        const int start_time_min,
+        const int start_time_max,
         const bool minimise_transfers,
-        const int max_traveltime);
+        const int max_traveltime,
+        const int service_day,
+        Rcpp::LogicalVector trip_mask);